@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+
+# Host backchannel between the sinks of a MULTI_SINK network.
+# Connects to the serial line of every sink (a device, or a Cooja serial socket
+# to run the bridge against a local simulation) and relays every line starting
+# with "BC " to the other sinks, see src/include/backchannel.h.
+#
+# The routes shared by the sinks and their announcements are cached and replayed
+# to a sink that reboots, so that it can reach the nodes of the other trees right away.
+#
+# Examples:
+#   ./backchannel.py --socket localhost:60001 --socket localhost:60010
+#   ./backchannel.py --serial /dev/ttyUSB0 --serial /dev/ttyUSB1
+
+import re
+import sys
+import time
+import socket
+import argparse
+import threading
+
+BC_PREFIX = b"BC "
+regex_route = re.compile(r"BC route (?P<child>\w\w:\w\w) (?P<parent>\w\w:\w\w)")
+regex_sink = re.compile(r"BC sink (?P<sink>\w\w:\w\w)")
+regex_boot = re.compile(r"App: I am sink")
+
+
+class Endpoint:
+    """Line oriented connection to the serial line of a sink."""
+
+    def __init__(self, name):
+        self.name = name
+        self.lock = threading.Lock()
+
+    def read(self):
+        raise NotImplementedError
+
+    def write(self, data):
+        raise NotImplementedError
+
+    def send_line(self, line):
+        with self.lock:
+            self.write(line + b"\n")
+
+
+class SocketEndpoint(Endpoint):
+
+    def __init__(self, address):
+        super().__init__(address)
+        host, port = address.rsplit(':', 1)
+        self.sock = socket.create_connection((host, int(port)))
+
+    def read(self):
+        while True:
+            data = self.sock.recv(1024)
+            if not data:
+                return
+            yield data
+
+    def write(self, data):
+        self.sock.sendall(data)
+
+
+class SerialEndpoint(Endpoint):
+
+    def __init__(self, device, baud):
+        super().__init__(device)
+        import serial  # pyserial, only needed for this endpoint
+        self.port = serial.Serial(device, baud, timeout=0.5)
+
+    def read(self):
+        while True:
+            yield self.port.read(256)
+
+    def write(self, data):
+        self.port.write(data)
+
+
+class Bridge:
+
+    def __init__(self, endpoints, verbose):
+        self.endpoints = endpoints
+        self.verbose = verbose
+        self.lock = threading.Lock()
+        # Last parent shared for every child
+        self.routes = {}
+        # Sinks announced on the backchannel
+        self.sinks = set()
+
+    def relay(self, source, line):
+        with self.lock:
+            m = regex_route.match(line.decode('ascii', errors='replace'))
+            if m:
+                self.routes[m.group('child')] = m.group('parent')
+            m = regex_sink.match(line.decode('ascii', errors='replace'))
+            if m:
+                self.sinks.add(m.group('sink'))
+        for endpoint in self.endpoints:
+            if endpoint is not source:
+                endpoint.send_line(line)
+
+    def replay(self, endpoint):
+        with self.lock:
+            routes = list(self.routes.items())
+            sinks = list(self.sinks)
+        for sink in sinks:
+            endpoint.send_line("BC sink {}".format(sink).encode())
+        for child, parent in routes:
+            endpoint.send_line("BC route {} {}".format(child, parent).encode())
+        print("{}: sink started, replayed {} routes".format(endpoint.name, len(routes)))
+
+    def handle_line(self, endpoint, line):
+        start = line.find(BC_PREFIX)
+        if start >= 0:
+            # Binary reports may precede the message on the same line
+            self.relay(endpoint, line[start:])
+            if self.verbose:
+                print("{} > {}".format(endpoint.name, line[start:].decode('ascii', errors='replace')))
+        elif regex_boot.search(line.decode('ascii', errors='replace')):
+            self.replay(endpoint)
+        elif self.verbose:
+            print("{}: {}".format(endpoint.name, line.decode('ascii', errors='replace')))
+
+    def run_endpoint(self, endpoint):
+        buf = bytearray()
+        for data in endpoint.read():
+            buf.extend(data)
+            while True:
+                newline = buf.find(b'\n')
+                if newline < 0:
+                    break
+                line = bytes(buf[:newline]).strip()
+                del buf[:newline + 1]
+                if line:
+                    self.handle_line(endpoint, line)
+        print("{}: connection closed".format(endpoint.name))
+
+    def run(self):
+        threads = [threading.Thread(target=self.run_endpoint, args=(e,), daemon=True) for e in self.endpoints]
+        for thread in threads:
+            thread.start()
+        while any(thread.is_alive() for thread in threads):
+            time.sleep(0.5)
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--serial', type=str, action='append', default=[], help="serial device of a sink")
+    parser.add_argument('--socket', type=str, action='append', default=[], help="host:port of the Cooja serial socket of a sink")
+    parser.add_argument('--baud', type=int, default=115200, help="serial baud rate")
+    parser.add_argument('-v', '--verbose', action='store_true', help="print every line read from the sinks")
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+
+    args = parse_args()
+    endpoints = [SocketEndpoint(a) for a in args.socket] + [SerialEndpoint(d, args.baud) for d in args.serial]
+    if len(endpoints) < 2:
+        print("At least two sinks are needed for the backchannel.")
+        sys.exit(1)
+
+    try:
+        Bridge(endpoints, args.verbose).run()
+    except KeyboardInterrupt:
+        pass
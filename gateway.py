@@ -0,0 +1,348 @@
+#!/usr/bin/env python3
+
+# Streaming gateway for the sink serial output.
+# Reads the sink serial line (or a Cooja serial socket, or a log being written)
+# incrementally and keeps rolling per-node statistics in memory. The statistics
+# are printed periodically and served as JSON on a local HTTP endpoint.
+#
+# Both the text reports and the binary frames of SINK_BINARY_REPORT are decoded.
+#
+# Examples:
+#   ./gateway.py --serial /dev/ttyUSB0
+#   ./gateway.py --socket localhost:60001
+#   ./gateway.py --follow test.log
+
+import re
+import sys
+import json
+import time
+import struct
+import socket
+import os.path
+import argparse
+import threading
+import importlib.util
+from collections import defaultdict, deque
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+# Binary frames, see src/tools/sink-report.h
+SYNC = b'\xa5\x5a'
+REPORT_RECV = 1
+REPORT_SR_SENT = 2
+report_formats = {
+    REPORT_RECV: struct.Struct('<2sHB'),
+    REPORT_SR_SENT: struct.Struct('<2sH'),
+}
+
+# Optional prefixes added by Cooja and by the testbed logger, the node id is taken from them
+regex_prefix = re.compile(r"(?:[\w:.]+\s+ID:(?P<cooja_id>\d+)\s+|.*firefly\.(?P<testbed_id>\d+): \d+\.firefly < b')")
+regex_recv = re.compile(r"App: recv from (?P<src1>\w+):(?P<src2>\w+) seqn (?P<seqn>\d+) hops (?P<hops>\d+)")
+regex_sent = re.compile(r"App: send seqn (?P<seqn>\d+)")
+regex_srrecv = re.compile(r"App: sr_recv from sink seqn (?P<seqn>\d+) hops (?P<hops>\d+)")
+regex_srsent = re.compile(r"App: sink sending seqn (?P<seqn>\d+) to (?P<dest1>\w+):(?P<dest2>\w+)")
+regex_piggyback = re.compile(r"Protocol: (piggyback|path record) topology update")
+regex_dedicated_topology = re.compile(r"Protocol: dedicated topology update")
+regex_dc = re.compile(r"Energest: (?P<cnt>\d+) (?P<cpu>\d+) (?P<lpm>\d+) (?P<tx>\d+) (?P<rx>\d+)")
+
+
+def load_addr_id_map():
+    # Reuse the Firefly address map of the offline analysis
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "parse-stats.py")
+    spec = importlib.util.spec_from_file_location("parse_stats", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module.addr_id_map
+
+
+class FrameDecoder:
+    """Split a byte stream in text lines and binary report frames."""
+
+    def __init__(self):
+        self.buf = bytearray()
+        # Text read before a frame, the line continues after it
+        self.partial = bytearray()
+
+    def feed(self, data):
+        self.buf.extend(data)
+        events = []
+        while self.buf:
+            sync = self.buf.find(SYNC)
+            newline = self.buf.find(b'\n')
+            if sync < 0 and newline < 0:
+                # Keep a trailing sync byte, the frame may be split across reads
+                break
+            if sync < 0 or (0 <= newline < sync):
+                line = (self.partial + self.buf[:newline]).decode('ascii', errors='replace').strip()
+                self.partial = bytearray()
+                del self.buf[:newline + 1]
+                if line:
+                    events.append(('line', line))
+                continue
+            # Text before the frame
+            if sync > 0:
+                self.partial.extend(self.buf[:sync])
+                del self.buf[:sync]
+            if len(self.buf) < 4:
+                break
+            rtype, length = self.buf[2], self.buf[3]
+            if len(self.buf) < 5 + length:
+                break
+            payload = bytes(self.buf[4:4 + length])
+            checksum = rtype ^ length
+            for b in payload:
+                checksum ^= b
+            if checksum != self.buf[4 + length]:
+                # Not a frame, skip the sync and resynchronize
+                del self.buf[:1]
+                continue
+            del self.buf[:5 + length]
+            events.append(('frame', rtype, payload))
+        return events
+
+
+class NetworkStats:
+    """Rolling per-node statistics over the last [window] seconds."""
+
+    def __init__(self, window, sink_id, testbed, addr_id_map):
+        self.window = window
+        self.sink_id = sink_id
+        self.testbed = testbed
+        self.addr_id_map = addr_id_map
+        self.lock = threading.Lock()
+        self.started = time.time()
+        # node id -> deque of (time, seqn, hops)
+        self.recv = defaultdict(deque)
+        # node id -> deque of (time, seqn)
+        self.sent = defaultdict(deque)
+        self.srsent = defaultdict(deque)
+        self.srrecv = defaultdict(deque)
+        # node id -> deque of (time, cpu, lpm, tx, rx)
+        self.energest = defaultdict(deque)
+        # deque of (time, kind)
+        self.topology = deque()
+
+    def addr_to_id(self, a1, a2):
+        if self.testbed:
+            return self.addr_id_map.get("{}:{}".format(a1, a2))
+        # Discard second byte, and convert to decimal
+        return int(a1, 16)
+
+    def handle_line(self, line, now):
+        node_id = self.sink_id
+        m = regex_prefix.match(line)
+        if m:
+            node_id = int(m.group('cooja_id') or m.group('testbed_id'))
+        with self.lock:
+            m = regex_recv.search(line)
+            if m:
+                src = self.addr_to_id(m.group('src1'), m.group('src2'))
+                self.recv[src].append((now, int(m.group('seqn')), int(m.group('hops'))))
+                return
+            m = regex_sent.search(line)
+            if m:
+                self.sent[node_id].append((now, int(m.group('seqn'))))
+                return
+            m = regex_srsent.search(line)
+            if m:
+                dest = self.addr_to_id(m.group('dest1'), m.group('dest2'))
+                self.srsent[dest].append((now, int(m.group('seqn'))))
+                return
+            m = regex_srrecv.search(line)
+            if m:
+                self.srrecv[node_id].append((now, int(m.group('seqn')), int(m.group('hops'))))
+                return
+            m = regex_dc.search(line)
+            if m:
+                # Discard first two Energest report
+                if int(m.group('cnt')) >= 2:
+                    self.energest[node_id].append((now, int(m.group('cpu')), int(m.group('lpm')),
+                                                   int(m.group('tx')), int(m.group('rx'))))
+                return
+            if regex_piggyback.search(line):
+                self.topology.append((now, 'piggyback'))
+            elif regex_dedicated_topology.search(line):
+                self.topology.append((now, 'dedicated'))
+
+    def handle_frame(self, rtype, payload, now):
+        fmt = report_formats.get(rtype)
+        if fmt is None or len(payload) != fmt.size:
+            return
+        fields = fmt.unpack(payload)
+        addr = fields[0]
+        node_id = self.addr_to_id("{:02x}".format(addr[0]), "{:02x}".format(addr[1]))
+        with self.lock:
+            if rtype == REPORT_RECV:
+                self.recv[node_id].append((now, fields[1], fields[2]))
+            elif rtype == REPORT_SR_SENT:
+                self.srsent[node_id].append((now, fields[1]))
+
+    def _expire(self, now):
+        limit = now - self.window
+        for series in (self.recv, self.sent, self.srsent, self.srrecv, self.energest):
+            for q in series.values():
+                while q and q[0][0] < limit:
+                    q.popleft()
+        while self.topology and self.topology[0][0] < limit:
+            self.topology.popleft()
+
+    @staticmethod
+    def _pdr(sent, recv):
+        received = set(r[1] for r in recv)
+        if sent:
+            # Packets sent in the window, the ones received are counted once
+            expected = set(s[1] for s in sent)
+            return 100 * len(received & expected) / len(expected)
+        if received:
+            # Only the sink output is available, infer the packets sent from the seqn span
+            return 100 * len(received) / (max(received) - min(received) + 1)
+        return None
+
+    def snapshot(self):
+        now = time.time()
+        with self.lock:
+            self._expire(now)
+            span = min(self.window, now - self.started) or 1
+            nodes = {}
+            ids = set(self.recv) | set(self.sent) | set(self.srsent) | set(self.srrecv) | set(self.energest)
+            for node in sorted(i for i in ids if i is not None):
+                recv, srrecv, energest = self.recv[node], self.srrecv[node], self.energest[node]
+                stats = {
+                    'rx': len(recv),
+                    'pdr': self._pdr(self.sent[node], recv),
+                    'hops': sum(r[2] for r in recv) / len(recv) if recv else None,
+                    'sr_rx': len(srrecv),
+                    'sr_pdr': self._pdr(self.srsent[node], srrecv) if srrecv or self.srsent[node] else None,
+                    'duty_cycle': None,
+                }
+                total_time = sum(e[1] + e[2] for e in energest)
+                if total_time > 0:
+                    stats['duty_cycle'] = 100 * sum(e[3] + e[4] for e in energest) / total_time
+                nodes[node] = stats
+            piggyback = sum(1 for t in self.topology if t[1] == 'piggyback')
+            dedicated = len(self.topology) - piggyback
+            return {
+                'time': now,
+                'window': self.window,
+                'nodes': nodes,
+                'topology_updates_per_minute': {
+                    'piggyback': 60 * piggyback / span,
+                    'dedicated': 60 * dedicated / span,
+                },
+            }
+
+
+def format_summary(snap):
+    def fmt(value, spec):
+        return "-" if value is None else spec.format(value)
+
+    lines = ["----- Gateway Statistics (last {}s) -----".format(snap['window'])]
+    for node, s in snap['nodes'].items():
+        lines.append("Node {}: RX = {}, PDR = {}, hops = {}, SR RX = {}, SR PDR = {}, Duty Cycle = {}".format(
+            node, s['rx'], fmt(s['pdr'], "{:.2f}%"), fmt(s['hops'], "{:.2f}"),
+            s['sr_rx'], fmt(s['sr_pdr'], "{:.2f}%"), fmt(s['duty_cycle'], "{:.3f}%")))
+    rates = snap['topology_updates_per_minute']
+    lines.append("Topology updates/min: piggyback {:.2f}, dedicated {:.2f}".format(
+        rates['piggyback'], rates['dedicated']))
+    return "\n".join(lines)
+
+
+def serve_http(stats, port):
+    class Handler(BaseHTTPRequestHandler):
+        def do_GET(self):
+            if self.path not in ('/', '/stats'):
+                self.send_error(404)
+                return
+            body = json.dumps(stats.snapshot()).encode()
+            self.send_response(200)
+            self.send_header('Content-Type', 'application/json')
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+        def log_message(self, *args):
+            pass
+
+    server = ThreadingHTTPServer(('127.0.0.1', port), Handler)
+    thread = threading.Thread(target=server.serve_forever, daemon=True)
+    thread.start()
+    return server
+
+
+def read_serial(device, baud):
+    import serial  # pyserial, only needed for this source
+    with serial.Serial(device, baud, timeout=0.5) as port:
+        while True:
+            yield port.read(256)
+
+
+def read_socket(address):
+    host, port = address.rsplit(':', 1)
+    with socket.create_connection((host, int(port))) as sock:
+        while True:
+            data = sock.recv(1024)
+            if not data:
+                return
+            yield data
+
+
+def read_follow(path, from_start):
+    with open(path, 'rb') as f:
+        if not from_start:
+            f.seek(0, os.SEEK_END)
+        while True:
+            data = f.read(4096)
+            if not data:
+                time.sleep(0.2)
+                yield b''
+                continue
+            yield data
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument('--serial', type=str, help="serial device of the sink")
+    source.add_argument('--socket', type=str, help="host:port of a Cooja serial socket")
+    source.add_argument('--follow', type=str, help="log file to follow while it is written")
+    parser.add_argument('--baud', type=int, default=115200, help="serial baud rate")
+    parser.add_argument('--from-start', action='store_true', help="with --follow, read the file from the beginning")
+    parser.add_argument('-t', '--testbed', action='store_true', help="flag for testbed experiments")
+    parser.add_argument('--sink-id', type=int, default=1, help="id of the sink, for lines without a node prefix")
+    parser.add_argument('--window', type=int, default=300, help="seconds of history used for the statistics")
+    parser.add_argument('--interval', type=int, default=30, help="seconds between two printed summaries")
+    parser.add_argument('--http-port', type=int, default=8080, help="port of the local JSON endpoint, 0 disables it")
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+
+    args = parse_args()
+    stats = NetworkStats(args.window, args.sink_id, args.testbed, load_addr_id_map() if args.testbed else {})
+    if args.http_port > 0:
+        serve_http(stats, args.http_port)
+        print("Serving statistics on http://127.0.0.1:{}/stats".format(args.http_port))
+
+    if args.serial:
+        source = read_serial(args.serial, args.baud)
+    elif args.socket:
+        source = read_socket(args.socket)
+    else:
+        source = read_follow(args.follow, args.from_start)
+
+    decoder = FrameDecoder()
+    next_summary = time.time() + args.interval
+    try:
+        for data in source:
+            now = time.time()
+            for event in decoder.feed(data):
+                if event[0] == 'line':
+                    stats.handle_line(event[1], now)
+                else:
+                    stats.handle_frame(event[1], event[2], now)
+            if now >= next_summary:
+                print(format_summary(stats.snapshot()))
+                sys.stdout.flush()
+                next_summary = now + args.interval
+    except KeyboardInterrupt:
+        pass
+    print(format_summary(stats.snapshot()))
@@ -11,6 +11,8 @@ import pandas as pd
 from datetime import datetime
 
 sink_id = 1 # Change this value if you decide to consider another sink!
+# All the sinks of a MULTI_SINK network, the first one generates the one-to-many traffic. Set with --sinks
+sink_ids = [sink_id]
 
 # Firefly addresses
 addr_id_map = {
@@ -42,6 +44,7 @@ def parse_file(log_file, testbed=False):
     fsrrecv_name = os.path.join(fpath, f"{fname_common}-srecv.csv")
     fsrsent_name = os.path.join(fpath, f"{fname_common}-ssent.csv")
     fenergest_name = os.path.join(fpath, f"{fname_common}-energest.csv")
+    fmemory_name = os.path.join(fpath, f"{fname_common}-memory.csv")
     
     # Open CSV output files
     frecv = open(frecv_name, 'w')
@@ -49,44 +52,73 @@ def parse_file(log_file, testbed=False):
     fsrrecv = open(fsrrecv_name, 'w')
     fsrsent = open(fsrsent_name , 'w')
     fenergest = open(fenergest_name, 'w')
+    fmemory = open(fmemory_name, 'w')
 
     # Write CSV headers
-    frecv.write("time\tdest\tsrc\tseqn\thops\n")
-    fsent.write("time\tdest\tsrc\tseqn\n")
-    fsrrecv.write("time\tdest\tsrc\tseqn\thops\tmetric\n")
-    fsrsent.write("time\tdest\tsrc\tseqn\n")
+    frecv.write("time\tdest\tsrc\tseqn\thops\tdelay\n")
+    fsent.write("time\tdest\tsrc\tseqn\tclass\n")
+    fsrrecv.write("time\tdest\tsrc\tseqn\thops\tmetric\tdelay\n")
+    fsrsent.write("time\tdest\tsrc\tseqn\tclass\n")
     fenergest.write("time\tnode\tcnt\tcpu\tlpm\ttx\trx\n")
+    fmemory.write("time\tnode\tcnt\theap\theap_peak\tstack_peak\tfree_ram\tfailures\n")
 
     # Regular expressions
     if testbed:
         # Regex for testbed experiments
         testbed_record_pattern = r"\[(?P<time>.{23})\] INFO:firefly\.(?P<self_id>\d+): \d+\.firefly < b"
         regex_node = re.compile(r"{}'Rime started with address (?P<src1>\d+).(?P<src2>\d+)'".format(testbed_record_pattern))
-        regex_recv = re.compile(r"{}'App: recv from (?P<src1>\w+):(?P<src2>\w+) seqn (?P<seqn>\d+) hops (?P<hops>\d+)'".format(testbed_record_pattern))
-        regex_sent = re.compile(r"{}'App: send seqn (?P<seqn>\d+)'".format(testbed_record_pattern))
-        regex_srrecv = re.compile(r"{}'App: sr_recv from sink seqn (?P<seqn>\d+) hops (?P<hops>\d+) node metric (?P<metric>\d+)'".format(testbed_record_pattern))
-        regex_srsent = re.compile(r"{}'App: sink sending seqn (?P<seqn>\d+) to (?P<dest1>\w+):(?P<dest2>\w+)'".format(testbed_record_pattern))
-        regex_piggyback = re.compile(r"{}Protocol: piggyback topology update".format(record_pattern))
-        regex_dedicated_topology =re.compile(r"{}Protocol: dedicated topology update".format(record_pattern))
+        regex_recv = re.compile(r"{}'App: recv from (?P<src1>\w+):(?P<src2>\w+) seqn (?P<seqn>\d+) hops (?P<hops>\d+)(?: delay (?P<delay>\d+))?'".format(testbed_record_pattern))
+        regex_sent = re.compile(r"{}'App: send seqn (?P<seqn>\d+)(?: class (?P<tclass>\d+))?'".format(testbed_record_pattern))
+        regex_srrecv = re.compile(r"{}'App: sr_recv from sink seqn (?P<seqn>\d+) hops (?P<hops>\d+) node metric (?P<metric>\d+)(?: delay (?P<delay>\d+))?'".format(testbed_record_pattern))
+        regex_srsent = re.compile(r"{}'App: sink sending seqn (?P<seqn>\d+) to (?P<dest1>\w+):(?P<dest2>\w+)(?: class (?P<tclass>\d+))?'".format(testbed_record_pattern))
+        regex_piggyback = re.compile(r"{}'Protocol: piggyback topology update'".format(testbed_record_pattern))
+        regex_dedicated_topology =re.compile(r"{}'Protocol: dedicated topology update'".format(testbed_record_pattern))
+        regex_path_record = re.compile(r"{}'Protocol: path record topology update'".format(testbed_record_pattern))
+        regex_backlog_drop = re.compile(r"{}'Protocol: backlog drop class (?P<tclass>\d+)'".format(testbed_record_pattern))
+        regex_backlog_early = re.compile(r"{}'Protocol: backlog early send class \d+'".format(testbed_record_pattern))
+        regex_reliable = re.compile(r"{}'App: reliable id \d+ to \w+:\w+ (?P<result>acked|failed)'".format(testbed_record_pattern))
+        regex_repair = re.compile(r"{}'Protocol: local repair (?P<event>request|reply|via)".format(testbed_record_pattern))
         regex_dc = re.compile(r"{}'Energest: (?P<cnt>\d+) (?P<cpu>\d+) "
                               r"(?P<lpm>\d+) (?P<tx>\d+) (?P<rx>\d+)'".format(testbed_record_pattern))
+        regex_mem = re.compile(r"{}'Memory: (?P<cnt>\d+) (?P<heap>\d+) (?P<heap_peak>\d+) "
+                               r"(?P<stack_peak>\d+) (?P<free_ram>\d+) (?P<failures>\d+)'".format(testbed_record_pattern))
+        regex_mem_static = re.compile(r"{}'Memory: static (?P<sizes>.*)'".format(testbed_record_pattern))
     else:
         # Regular expressions for COOJA
         record_pattern = r"(?P<time>[\w:.]+)\s+ID:(?P<self_id>\d+)\s+"
         regex_node = re.compile(r"{}Rime started with address (?P<src1>\d+).(?P<src2>\d+)".format(record_pattern))
-        regex_recv = re.compile(r"{}App: recv from (?P<src1>\w+):(?P<src2>\w+) seqn (?P<seqn>\d+) hops (?P<hops>\d+)".format(record_pattern))
-        regex_sent = re.compile(r"{}App: send seqn (?P<seqn>\d+)".format(record_pattern))
-        regex_srrecv = re.compile(r"{}App: sr_recv from sink seqn (?P<seqn>\d+) hops (?P<hops>\d+) node metric (?P<metric>\d+)".format(record_pattern))
-        regex_srsent = re.compile(r"{}App: sink sending seqn (?P<seqn>\d+) to (?P<dest1>\w+):(?P<dest2>\w+)".format(record_pattern))
+        regex_recv = re.compile(r"{}App: recv from (?P<src1>\w+):(?P<src2>\w+) seqn (?P<seqn>\d+) hops (?P<hops>\d+)(?: delay (?P<delay>\d+))?".format(record_pattern))
+        regex_sent = re.compile(r"{}App: send seqn (?P<seqn>\d+)(?: class (?P<tclass>\d+))?".format(record_pattern))
+        regex_srrecv = re.compile(r"{}App: sr_recv from sink seqn (?P<seqn>\d+) hops (?P<hops>\d+) node metric (?P<metric>\d+)(?: delay (?P<delay>\d+))?".format(record_pattern))
+        regex_srsent = re.compile(r"{}App: sink sending seqn (?P<seqn>\d+) to (?P<dest1>\w+):(?P<dest2>\w+)(?: class (?P<tclass>\d+))?".format(record_pattern))
         regex_piggyback = re.compile(r"{}Protocol: piggyback topology update".format(record_pattern))
         regex_dedicated_topology =re.compile(r"{}Protocol: dedicated topology update".format(record_pattern))
+        regex_path_record = re.compile(r"{}Protocol: path record topology update".format(record_pattern))
+        regex_backlog_drop = re.compile(r"{}Protocol: backlog drop class (?P<tclass>\d+)".format(record_pattern))
+        regex_backlog_early = re.compile(r"{}Protocol: backlog early send class \d+".format(record_pattern))
+        regex_reliable = re.compile(r"{}App: reliable id \d+ to \w+:\w+ (?P<result>acked|failed)".format(record_pattern))
+        regex_repair = re.compile(r"{}Protocol: local repair (?P<event>request|reply|via)".format(record_pattern))
         regex_dc = re.compile(r"{}Energest: (?P<cnt>\d+) (?P<cpu>\d+) "
                               r"(?P<lpm>\d+) (?P<tx>\d+) (?P<rx>\d+)".format(record_pattern))
+        regex_mem = re.compile(r"{}Memory: (?P<cnt>\d+) (?P<heap>\d+) (?P<heap_peak>\d+) "
+                               r"(?P<stack_peak>\d+) (?P<free_ram>\d+) (?P<failures>\d+)".format(record_pattern))
+        regex_mem_static = re.compile(r"{}Memory: static (?P<sizes>.*)".format(record_pattern))
 
     # Check if any node resets
     num_resets = 0
     num_piggbacks = 0
     num_dedicated_topology_updates = 0
+    num_path_records = 0
+    # Packets dropped by the transmit backlogs, per traffic class
+    backlog_drops = {}
+    # Packets sent ahead of the slot because the backlog was full, with SLOTTED_SCHEDULE
+    num_backlog_early = 0
+    # Completions of the reliable one-to-many messages
+    reliable_results = {"acked": 0, "failed": 0}
+    # Local repair requests, replies and reattached nodes, with LOCAL_REPAIR
+    repair_events = {"request": 0, "reply": 0, "via": 0}
+    # Sizes of the static protocol structures, with MEM_STATS
+    static_sizes = None
     # Parse log file and add data to CSV files
     with open(log_file, 'r') as f:
         for line in f:
@@ -96,6 +128,22 @@ def parse_file(log_file, testbed=False):
             m = regex_dedicated_topology.match(line)
             if m:
                 num_dedicated_topology_updates += 1
+            m = regex_path_record.match(line)
+            if m:
+                num_path_records += 1
+            m = regex_backlog_drop.match(line)
+            if m:
+                tclass = int(m.group("tclass"))
+                backlog_drops[tclass] = backlog_drops.get(tclass, 0) + 1
+            m = regex_backlog_early.match(line)
+            if m:
+                num_backlog_early += 1
+            m = regex_reliable.match(line)
+            if m:
+                reliable_results[m.group("result")] += 1
+            m = regex_repair.match(line)
+            if m:
+                repair_events[m.group("event")] += 1
 
             # Node boot
             m = regex_node.match(line)
@@ -128,6 +176,23 @@ def parse_file(log_file, testbed=False):
                 # Continue with the following line
                 continue
 
+            # Memory usage, with MEM_STATS
+            m = regex_mem.match(line)
+            if m:
+                d = m.groupdict()
+                if testbed:
+                    ts = datetime.strptime(d["time"], '%Y-%m-%d %H:%M:%S,%f')
+                    ts = ts.timestamp()
+                else:
+                    ts = d["time"]
+                fmemory.write("{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\n".format(
+                    ts, d['self_id'], d['cnt'], d['heap'], d['heap_peak'], d['stack_peak'], d['free_ram'], d['failures']))
+                continue
+            m = regex_mem_static.match(line)
+            if m:
+                static_sizes = m.group("sizes").strip()
+                continue
+
             # RECV 
             m = regex_recv.match(line)
             if m:
@@ -150,7 +215,7 @@ def parse_file(log_file, testbed=False):
                 hops = int(d["hops"])
 
                 # Write to CSV file
-                frecv.write("{}\t{}\t{}\t{}\t{}\n".format(ts, dest, src, seqn, hops))
+                frecv.write("{}\t{}\t{}\t{}\t{}\t{}\n".format(ts, dest, src, seqn, hops, d["delay"] or ""))
 
                 # Continue with the following line
                 continue
@@ -165,11 +230,11 @@ def parse_file(log_file, testbed=False):
                 else:
                     ts = d["time"]
                 src = int(d["self_id"])
-                dest = sink_id
+                dest = sink_ids[0]
                 seqn = int(d["seqn"])
 
                 # Write to CSV file
-                fsent.write("{}\t{}\t{}\t{}\n".format(ts, dest, src, seqn))
+                fsent.write("{}\t{}\t{}\t{}\t{}\n".format(ts, dest, src, seqn, d["tclass"] or ""))
 
                 # Continue with the following line
                 continue
@@ -183,13 +248,13 @@ def parse_file(log_file, testbed=False):
                     ts = ts.timestamp()
                 else:
                     ts = d["time"]
-                src = sink_id
+                src = sink_ids[0]
                 dest = int(d["self_id"])
                 seqn = int(d["seqn"])
                 hops = int(d["hops"])
                 metric = int(d["metric"])
 
-                fsrrecv.write("{}\t{}\t{}\t{}\t{}\t{}\n".format(ts, dest, src, seqn, hops, metric))
+                fsrrecv.write("{}\t{}\t{}\t{}\t{}\t{}\t{}\n".format(ts, dest, src, seqn, hops, metric, d["delay"] or ""))
 
                 # Continue with the following line
                 continue
@@ -214,7 +279,7 @@ def parse_file(log_file, testbed=False):
                 src = int(d["self_id"])
                 seqn = int(d["seqn"])
 
-                fsrsent.write("{}\t{}\t{}\t{}\n".format(ts, dest, src, seqn))
+                fsrsent.write("{}\t{}\t{}\t{}\t{}\n".format(ts, dest, src, seqn, d["tclass"] or ""))
 
     # Close files
     frecv.close()
@@ -222,6 +287,7 @@ def parse_file(log_file, testbed=False):
     fsrrecv.close()
     fsrsent.close()
     fenergest.close()
+    fmemory.close()
 
     if num_resets > 0:
         print("----- WARNING -----")
@@ -237,13 +303,133 @@ def parse_file(log_file, testbed=False):
     # Compute node duty cycle
     compute_node_duty_cycle(fenergest_name)
 
-    compute_topology_updates_stats(num_piggbacks, num_dedicated_topology_updates)
+    # Compute heap and stack usage, with MEM_STATS
+    compute_memory_stats(fmemory_name, static_sizes)
 
-def compute_topology_updates_stats(num_piggybacks, num_dedicated):
-    total_updates = num_piggybacks + num_dedicated
+    compute_topology_updates_stats(num_piggbacks, num_dedicated_topology_updates, num_path_records)
+
+    # Compute end-to-end latency in both directions
+    compute_latency_stats(fsent_name, frecv_name, fsrsent_name, fsrrecv_name, testbed)
+
+    # Compute the end-to-end acknowledged deliveries, with RELIABLE_DOWNWARD
+    compute_reliable_stats(reliable_results)
+
+    # Compute the local repairs, with LOCAL_REPAIR
+    compute_repair_stats(repair_events)
+
+    # Compute delivery per traffic class, with TRAFFIC_CLASSES
+    compute_class_stats(fsent_name, frecv_name, fsrsent_name, fsrrecv_name)
+
+    # Compute the packets dropped by the transmit backlogs
+    compute_backlog_stats(backlog_drops, num_backlog_early)
+
+def compute_topology_updates_stats(num_piggybacks, num_dedicated, num_path_records):
+    total_updates = num_piggybacks + num_dedicated + num_path_records
     print("----- Topology updates -----")
     print("Piggybacks updates: {} > {:.2f}%".format(num_piggybacks, 100 * num_piggybacks / total_updates))
     print("Dedicated updates: {} > {:.2f}%".format(num_dedicated, 100 * num_dedicated / total_updates))
+    # Updates carried by the path recorded in the data forwarded by the node
+    print("Path record updates: {} > {:.2f}%".format(num_path_records, 100 * num_path_records / total_updates))
+
+
+def print_latency_distribution(df, key, label):
+    for value in sorted(df[key].unique()):
+        ldf = df[df[key] == value]
+        p50, p95, p99 = np.percentile(ldf.latency, [50, 95, 99])
+        line = "{} {}: Packets = {}, p50 = {:.1f} ms, p95 = {:.1f} ms, p99 = {:.1f} ms".format(
+            label, value, len(ldf), p50, p95, p99)
+        # Time spent queued in the forwarders, reported by the protocol with LATENCY_TRACKING.
+        # Only the protocol backlog is counted, 0 without SLOTTED_SCHEDULE or TRAFFIC_CLASSES
+        if ldf.delay.notna().any():
+            line += ", queueing p50 = {:.1f} ms".format(np.nanpercentile(ldf.delay, 50))
+        print(line)
+
+
+def compute_latency_stats(fsent_name, frecv_name, fsrsent_name, fsrrecv_name, testbed):
+
+    # Cooja logs times in microseconds, the testbed in seconds
+    to_ms = 1000 if testbed else 1 / 1000
+
+    directions = [
+        ("Data Collection", fsent_name, frecv_name, 'src'),
+        ("Source Routing", fsrsent_name, fsrrecv_name, 'dest'),
+    ]
+    for title, fsent, frecv, node_key in directions:
+        df_sent = pd.read_csv(fsent, sep='\t')
+        df_recv = pd.read_csv(frecv, sep='\t')
+        df_sent.drop_duplicates(['src', 'dest', 'seqn'], keep='first', inplace=True)
+        df_recv.drop_duplicates(['src', 'dest', 'seqn'], keep='first', inplace=True)
+
+        # Join every received packet with its transmission, with several sinks any of them may receive it
+        df = pd.merge(df_sent, df_recv, on=[node_key, 'seqn'], suffixes=('_sent', '_recv'))
+        if df.empty:
+            continue
+        df['latency'] = (df.time_recv.astype(float) - df.time_sent.astype(float)) * to_ms
+
+        print("\n----- {} Latency Statistics -----\n".format(title))
+        print_latency_distribution(df, node_key, "Node")
+        print("")
+        print_latency_distribution(df, 'hops', "Depth")
+        if df['class'].notna().any():
+            print("")
+            print_latency_distribution(df[df['class'].notna()], 'class', "Class")
+        p50, p95, p99 = np.percentile(df.latency, [50, 95, 99])
+        print("\nOverall: p50 = {:.1f} ms, p95 = {:.1f} ms, p99 = {:.1f} ms".format(p50, p95, p99))
+
+
+def compute_reliable_stats(results):
+    total = results["acked"] + results["failed"]
+    if total == 0:
+        return
+    print("\n----- Reliable Source Routing Statistics -----\n")
+    print("Acknowledged: {}, Failed after the retries: {}, Acknowledged = {:.2f}%".format(
+        results["acked"], results["failed"], 100 * results["acked"] / total))
+
+
+def compute_repair_stats(events):
+    if events["request"] == 0:
+        return
+    print("\n----- Local Repair Statistics -----\n")
+    print("Requests: {}, Replies: {}, Repairs: {}, Replies per request = {:.2f}".format(
+        events["request"], events["reply"], events["via"], events["reply"] / events["request"]))
+
+
+class_names = {0: "critical", 1: "normal", 2: "bulk"}
+
+
+def compute_class_stats(fsent_name, frecv_name, fsrsent_name, fsrrecv_name):
+
+    directions = [
+        ("Data Collection", fsent_name, frecv_name, 'src'),
+        ("Source Routing", fsrsent_name, fsrrecv_name, 'dest'),
+    ]
+    for title, fsent, frecv, node_key in directions:
+        df_sent = pd.read_csv(fsent, sep='\t')
+        df_recv = pd.read_csv(frecv, sep='\t')
+        # The firmware reports the class only with TRAFFIC_CLASSES
+        df_sent = df_sent[df_sent['class'].notna()]
+        if df_sent.empty:
+            continue
+        df_sent.drop_duplicates(['src', 'dest', 'seqn'], keep='first', inplace=True)
+        # With several sinks any of them may receive the packet
+        df_recv = df_recv.drop_duplicates([node_key, 'seqn'], keep='first')
+        df = pd.merge(df_sent, df_recv[[node_key, 'seqn']], on=[node_key, 'seqn'], how='left', indicator=True)
+
+        print("\n----- {} Traffic Class Statistics -----\n".format(title))
+        for tclass in sorted(df['class'].unique()):
+            cdf = df[df['class'] == tclass]
+            nrecv = (cdf._merge == 'both').sum()
+            print("Class {} ({}): TX Packets = {}, RX Packets = {}, PDR = {:.2f}%".format(
+                int(tclass), class_names.get(int(tclass), "?"), len(cdf), nrecv, 100 * nrecv / len(cdf)))
+
+
+def compute_backlog_stats(backlog_drops, num_early):
+    print("\n----- Transmit Backlog Statistics -----\n")
+    # Without TRAFFIC_CLASSES every packet is in the normal class
+    print("Backlog drops: {}{}".format(sum(backlog_drops.values()), "".join(
+        ", {} {}".format(class_names.get(c, c), n) for c, n in sorted(backlog_drops.items()))))
+    if num_early > 0:
+        print("Sent ahead of the slot: {}".format(num_early))
 
 
 def compute_collection_stats(fsent_name, frecv_name):
@@ -251,8 +437,8 @@ def compute_collection_stats(fsent_name, frecv_name):
     df_sent = pd.read_csv(fsent_name, sep='\t')
     df_recv = pd.read_csv(frecv_name, sep='\t')
 
-    # Filter messages not received by the sink
-    df_recv = df_recv[df_recv.dest == sink_id]
+    # Filter messages not received by the sinks
+    df_recv = df_recv[df_recv.dest.isin(sink_ids)]
 
     # Remove duplicates, if any
     df_sent.drop_duplicates(['src', 'dest', 'seqn'], keep='first', inplace=True)
@@ -261,7 +447,7 @@ def compute_collection_stats(fsent_name, frecv_name):
     # Check if any node did not manage to send data
     fails = []
     for node_id in sorted(nodes):
-        if node_id == sink_id:
+        if node_id in sink_ids:
             continue
         if node_id not in df_sent.src.unique():
             fails.append(node_id)
@@ -300,6 +486,14 @@ def compute_collection_stats(fsent_name, frecv_name):
         print("Overall PDR = {:.2f}%".format(opdr))
         print("Overall PLR = {:.2f}%".format(100 - opdr))
 
+    # Share of the traffic collected by every sink
+    if len(sink_ids) > 1:
+        print("\n----- Data Collection Sink Statistics -----\n")
+        for sink in sink_ids:
+            nrecv = len(df_recv[df_recv.dest == sink])
+            print("Sink {}: RX Packets = {}, Share = {:.2f}%, Nodes = {}".format(
+                sink, nrecv, 100 * nrecv / max(trecv, 1), df_recv[df_recv.dest == sink].src.nunique()))
+
 
 def compute_srouting_stats(fsrsent_name , fsrrecv_name):
 
@@ -307,7 +501,7 @@ def compute_srouting_stats(fsrsent_name , fsrrecv_name):
     df_srrecv = pd.read_csv(fsrrecv_name, sep='\t')
 
     # Filter messages not sent by the sink
-    df_srsent = df_srsent[df_srsent.src == sink_id]
+    df_srsent = df_srsent[df_srsent.src == sink_ids[0]]
 
     # Remove duplicates, if any
     df_srsent.drop_duplicates(['src', 'dest', 'seqn'], keep='first', inplace=True)
@@ -343,6 +537,23 @@ def compute_srouting_stats(fsrsent_name , fsrrecv_name):
         print("Overall PLR = {:.2f}%".format(100 - opdr))
 
 
+def compute_memory_stats(fmemory_name, static_sizes):
+
+    df = pd.read_csv(fmemory_name, sep='\t')
+    if df.empty:
+        return
+
+    print("----- Memory Statistics -----\n")
+    if static_sizes:
+        print("Static structures (bytes): {}\n".format(static_sizes))
+    for node in sorted(df.node.unique()):
+        ndf = df[df.node == node]
+        print("Node {}: Heap = {} B, Heap peak = {} B, Stack peak = {} B, Min free RAM = {} B, Failed allocations = {}".format(
+            node, ndf.heap.iloc[-1], ndf.heap_peak.max(), ndf.stack_peak.max(), ndf.free_ram.min(), ndf.failures.max()))
+    print("\nOverall: Heap peak = {} B, Stack peak = {} B, Min free RAM = {} B\n".format(
+        df.heap_peak.max(), df.stack_peak.max(), df.free_ram.min()))
+
+
 def compute_node_duty_cycle(fenergest_name):
 
     # Read CSV file with dataframe
@@ -391,6 +602,8 @@ def parse_args():
                         help="data collection logfile to be parsed and analyzed.")
     parser.add_argument('-t', '--testbed', action='store_true',
                         help="flag for testbed experiments")
+    parser.add_argument('-s', '--sinks', type=str, default=str(sink_id),
+                        help="comma separated ids of the sinks, the first one sends the one-to-many traffic")
     return parser.parse_args()
 
 
@@ -408,6 +621,8 @@ if __name__ == '__main__':
         print("The logfile argument {} is not a file.".format(args.logfile))
         sys.exit(1)
 
+    sink_ids[:] = [int(i) for i in args.sinks.split(',')]
+
     # Parse log file, create CSV files, and print some stats
     parse_file(args.logfile, testbed=args.testbed)
 
@@ -0,0 +1,256 @@
+#!/usr/bin/env python3
+
+# Topology evolution analysis, requires TOPOLOGY_EVENTS_LOG in the firmware.
+# Reconstructs over time the actual tree (parent changes logged by the nodes)
+# and the view of the sinks (routing table changes), and reports:
+#   - reconvergence time after each disturbance
+#   - parent churn of every node
+#   - tree depth over time
+#   - fraction of time every node had a valid downward route
+#
+# Disturbances are the "Disturbance:" lines written by the dynamic Cooja
+# scenarios. Without them, a parent change after a quiet period of --settle
+# seconds starts a new disturbance.
+
+from __future__ import division
+
+import re
+import sys
+import os.path
+import argparse
+import importlib.util
+from datetime import datetime
+
+record_pattern = r"(?P<time>[\w:.]+)\s+ID:(?P<self_id>\d+)\s+"
+testbed_record_pattern = r"\[(?P<time>.{23})\] INFO:firefly\.(?P<self_id>\d+): \d+\.firefly < b'"
+
+
+def load_addr_id_map():
+    # Reuse the Firefly address map of parse-stats.py
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "parse-stats.py")
+    spec = importlib.util.spec_from_file_location("parse_stats", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module.addr_id_map
+
+
+class Topology:
+
+    def __init__(self, sinks):
+        self.sinks = sinks
+        # Actual parent of every node
+        self.parent = {}
+        # Routing table of every sink, child -> parent
+        self.routes = {sink: {} for sink in sinks}
+
+    def depth(self, node):
+        hops = 0
+        while node not in self.sinks:
+            node = self.parent.get(node)
+            hops += 1
+            if node is None or hops > len(self.parent) + 1:
+                return None
+        return hops
+
+    def route_valid(self, node):
+        # Walk the table of the sink sending the downward traffic, every hop must match the actual tree.
+        # With several sinks the route may end at another sink, that delivers the packet
+        table = self.routes[self.sinks[0]]
+        hops = 0
+        while node not in self.sinks:
+            parent = table.get(node)
+            if parent is None or parent != self.parent.get(node):
+                return False
+            node = parent
+            hops += 1
+            if hops > len(table):
+                return False
+        return True
+
+
+def parse_events(log_file, testbed, addr_id_map):
+    if testbed:
+        prefix = testbed_record_pattern
+    else:
+        prefix = record_pattern
+    regex_parent = re.compile(r"{}Topology: parent (?P<p1>\w+):(?P<p2>\w+) hops (?P<hops>\d+)".format(prefix))
+    regex_route = re.compile(r"{}Topology: route (?P<c1>\w+):(?P<c2>\w+) (?:> (?P<p1>\w+):(?P<p2>\w+)|removed)".format(prefix))
+    regex_disturbance = re.compile(r"{}Disturbance: (?P<what>.*)".format(prefix))
+    regex_any = re.compile(prefix)
+
+    def timestamp(d):
+        if testbed:
+            return datetime.strptime(d["time"], '%Y-%m-%d %H:%M:%S,%f').timestamp()
+        # Cooja logs times in microseconds
+        return int(d["time"]) / 1e6
+
+    def node_id(b1, b2):
+        if testbed:
+            return addr_id_map.get("{}:{}".format(b1, b2))
+        return int(b1, 16)  # Discard second byte, and convert to decimal
+
+    events = []
+    end = None
+    with open(log_file, 'r') as f:
+        for line in f:
+            m = regex_parent.match(line)
+            if m:
+                d = m.groupdict()
+                events.append((timestamp(d), 'parent', int(d["self_id"]), node_id(d["p1"], d["p2"]), int(d["hops"])))
+                continue
+            m = regex_route.match(line)
+            if m:
+                d = m.groupdict()
+                # Expired routes have no parent
+                parent = node_id(d["p1"], d["p2"]) if d["p1"] is not None else None
+                events.append((timestamp(d), 'route', int(d["self_id"]), node_id(d["c1"], d["c2"]), parent))
+                continue
+            m = regex_disturbance.match(line)
+            if m:
+                d = m.groupdict()
+                events.append((timestamp(d), 'disturbance', int(d["self_id"]), d["what"].strip("'"), None))
+                continue
+            m = regex_any.match(line)
+            if m:
+                end = timestamp(m.groupdict())
+    return events, end
+
+
+def find_disturbances(events, settle):
+    marked = [e[0] for e in events if e[1] == 'disturbance']
+    changes = [e[0] for e in events if e[1] == 'parent']
+    if not changes:
+        return []
+    # The initial formation of the tree is always the first one
+    starts = [changes[0]]
+    if marked:
+        starts += [t for t in marked if t > changes[0]]
+    else:
+        for prev, t in zip(changes, changes[1:]):
+            if t - prev >= settle:
+                starts.append(t)
+    return starts
+
+
+def analyze(events, end, sinks, settle, out_csv):
+    topo = Topology(sinks)
+    nodes = sorted({e[2] for e in events if e[1] == 'parent'})
+    churn = {node: 0 for node in nodes}
+    valid_time = {node: 0.0 for node in nodes}
+    disturbances = find_disturbances(events, settle)
+    # Accounting of the downward routes starts with the first route learned by the sink
+    route_times = [e[0] for e in events if e[1] == 'route' and e[2] == sinks[0]]
+    start = route_times[0] if route_times else None
+
+    # Last parent change of every disturbance
+    last_change = {}
+    samples = []
+
+    def current_disturbance(t):
+        d = None
+        for i, start_time in enumerate(disturbances):
+            if start_time <= t:
+                d = i
+        return d
+
+    def sample(t):
+        depths = [topo.depth(n) for n in nodes]
+        attached = [d for d in depths if d is not None]
+        valid = [n for n in nodes if topo.route_valid(n)]
+        samples.append((t, len(attached),
+                        max(attached) if attached else 0,
+                        sum(attached) / len(attached) if attached else 0,
+                        len(valid)))
+        return valid
+
+    prev_time = None
+    valid = []
+    for t, kind, node, a, b in events:
+        # Account the time elapsed since the previous event with the previous state
+        if prev_time is not None and start is not None and t > start:
+            for n in valid:
+                valid_time[n] += t - max(prev_time, start)
+        if kind == 'parent':
+            if topo.parent.get(node) is not None:
+                churn[node] += 1
+            topo.parent[node] = a
+            d = current_disturbance(t)
+            if d is not None:
+                last_change[d] = t
+        elif kind == 'route' and node in topo.routes:
+            if b is None:
+                topo.routes[node].pop(a, None)
+            else:
+                topo.routes[node][a] = b
+        valid = sample(t)
+        prev_time = t
+    if prev_time is not None and start is not None and end is not None and end > prev_time:
+        for n in valid:
+            valid_time[n] += end - max(prev_time, start)
+
+    print("----- Reconvergence Statistics -----\n")
+    for i, t in enumerate(disturbances):
+        label = "Initial formation" if i == 0 else "Disturbance {}".format(i)
+        tree = last_change.get(i, t) - t
+        # First time every node had a valid downward route once the tree stopped changing
+        next_start = disturbances[i + 1] if i + 1 < len(disturbances) else float('inf')
+        sink_view = next((s[0] for s in samples
+                          if last_change.get(i, t) <= s[0] < next_start and s[4] == len(nodes)), None)
+        print("{} at {:.1f} s: tree converged after {:.1f} s, downward routes valid after {}".format(
+            label, t, tree, "{:.1f} s".format(sink_view - t) if sink_view is not None else "never"))
+
+    print("\n----- Parent Churn Statistics -----\n")
+    duration = (end - disturbances[0]) / 3600 if end is not None and disturbances else 0
+    for node in nodes:
+        print("Node {}: Parent changes = {}, per hour = {:.2f}".format(
+            node, churn[node], churn[node] / duration if duration > 0 else 0))
+
+    print("\n----- Downward Route Validity Statistics -----\n")
+    window = end - start if end is not None and start is not None else 0
+    for node in nodes:
+        print("Node {}: Valid route {:.2f}% of the time".format(
+            node, 100 * valid_time[node] / window if window > 0 else 0))
+    if window > 0 and nodes:
+        print("\nOverall: {:.2f}%".format(100 * sum(valid_time.values()) / (window * len(nodes))))
+
+    print("\n----- Tree Depth Statistics -----\n")
+    if samples:
+        print("Maximum depth: {}".format(max(s[2] for s in samples)))
+        print("Final depth: max {}, mean {:.2f}, attached nodes {}/{}".format(
+            samples[-1][2], samples[-1][3], samples[-1][1], len(nodes)))
+
+    with open(out_csv, 'w') as f:
+        f.write("time\tattached\tmax_depth\tmean_depth\tvalid_routes\n")
+        for s in samples:
+            f.write("{:.3f}\t{}\t{}\t{:.3f}\t{}\n".format(*s))
+    print("\nTree over time saved in {}".format(out_csv))
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('logfile', action="store", type=str,
+                        help="logfile with the topology events to be analyzed.")
+    parser.add_argument('-t', '--testbed', action='store_true',
+                        help="flag for testbed experiments")
+    parser.add_argument('-s', '--sinks', type=str, default="1",
+                        help="comma separated ids of the sinks, the first one sends the one-to-many traffic")
+    parser.add_argument('--settle', type=float, default=30,
+                        help="seconds without parent changes separating two disturbances, when not marked in the log")
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+
+    args = parse_args()
+    if not os.path.isfile(args.logfile):
+        print("The logfile argument {} is not a file.".format(args.logfile))
+        sys.exit(1)
+
+    sinks = [int(i) for i in args.sinks.split(',')]
+    events, end = parse_events(args.logfile, args.testbed, load_addr_id_map() if args.testbed else {})
+    if not any(e[1] == 'parent' for e in events):
+        print("No topology events found, enable TOPOLOGY_EVENTS_LOG in params.h")
+        sys.exit(1)
+
+    fname_common = os.path.splitext(args.logfile)[0]
+    analyze(events, end, sinks, args.settle, "{}-topology.csv".format(fname_common))
@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+
+# Extracts from a Cooja or testbed log the conditions of the run, replayed by
+# the host build of the protocol (see replay.c):
+#   - nodes and sinks, from the "App: I am" lines
+#   - boot times, a node logging again "App: I am" rebooted
+#   - links and their RSSI, from the beacons logged with LINK_TRACE_LOG (or
+#     with LOG_ENABLED in protocol.c). Without them the links are only the
+#     parents logged with TOPOLOGY_EVENTS_LOG, with a fixed RSSI
+#   - the many-to-one and one-to-many messages sent by the app
+#
+# Examples:
+#   ./extract-trace.py ../test.testlog && ./replay ../test-trace.txt > replay.testlog
+#   ../parse-stats.py replay.testlog
+
+from __future__ import division
+
+import re
+import sys
+import os.path
+import argparse
+import importlib.util
+from datetime import datetime
+
+record_pattern = r"(?P<time>[\w:.]+)\s+ID:(?P<self_id>\d+)\s+"
+testbed_record_pattern = r"\[(?P<time>.{23})\] INFO:firefly\.(?P<self_id>\d+): \d+\.firefly < b'"
+
+
+def load_addr_id_map():
+    # Reuse the Firefly address map of parse-stats.py
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "parse-stats.py")
+    spec = importlib.util.spec_from_file_location("parse_stats", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module.addr_id_map
+
+
+def parse_log(log_file, testbed, addr_id_map):
+    if testbed:
+        prefix = testbed_record_pattern
+    else:
+        prefix = record_pattern
+    regex_boot = re.compile(r"{}App: I am (?P<role>sink|normal node)".format(prefix))
+    regex_beacon = re.compile(r"{}(?:Trace: beacon from|Protocol: beacon metrics from) "
+                              r"(?P<s1>\w+):(?P<s2>\w+) .*rssi (?P<rssi>-?\d+)".format(prefix))
+    regex_parent = re.compile(r"{}Topology: parent (?P<p1>\w+):(?P<p2>\w+) hops".format(prefix))
+    regex_sent = re.compile(r"{}App: send seqn (?P<seqn>\d+)(?: class (?P<tclass>\d+))?".format(prefix))
+    regex_srsent = re.compile(r"{}App: sink sending seqn (?P<seqn>\d+) to (?P<d1>\w+):(?P<d2>\w+)"
+                              r"(?: class (?P<tclass>\d+))?".format(prefix))
+    regex_any = re.compile(prefix)
+
+    def timestamp(d):
+        if testbed:
+            return datetime.strptime(d["time"], '%Y-%m-%d %H:%M:%S,%f').timestamp()
+        # Cooja logs times in microseconds
+        return int(d["time"]) / 1e6
+
+    def node_id(b1, b2):
+        if testbed:
+            return addr_id_map.get("{}:{}".format(b1, b2))
+        return int(b1, 16)  # Discard second byte, and convert to decimal
+
+    def tclass(d):
+        return int(d["tclass"]) if d["tclass"] is not None else -1
+
+    trace = {'nodes': {}, 'first': {}, 'boots': [], 'links': [], 'parents': [], 'traffic': []}
+    start = None
+    end = None
+    with open(log_file, 'r') as f:
+        for line in f:
+            m = regex_any.match(line)
+            if not m:
+                continue
+            d = m.groupdict()
+            t = timestamp(d)
+            node = int(d["self_id"])
+            if start is None:
+                start = t
+            end = t
+            trace['first'].setdefault(node, t)
+
+            m = regex_boot.match(line)
+            if m:
+                trace['nodes'][node] = m.group("role") == "sink"
+                trace['boots'].append((t, node))
+                continue
+            m = regex_beacon.match(line)
+            if m:
+                sender = node_id(m.group("s1"), m.group("s2"))
+                if sender is not None:
+                    trace['links'].append((t, sender, node, int(m.group("rssi"))))
+                continue
+            m = regex_parent.match(line)
+            if m:
+                parent = node_id(m.group("p1"), m.group("p2"))
+                if parent is not None:
+                    trace['parents'].append((t, parent, node))
+                continue
+            m = regex_sent.match(line)
+            if m:
+                trace['traffic'].append((t, "send", "{} {} {}".format(node, m.group("seqn"), tclass(m.groupdict()))))
+                continue
+            m = regex_srsent.match(line)
+            if m:
+                dest = node_id(m.group("d1"), m.group("d2"))
+                if dest is not None:
+                    trace['traffic'].append((t, "srsend", "{} {} {} {}".format(
+                        node, dest, m.group("seqn"), tclass(m.groupdict()))))
+                continue
+    trace['start'] = start
+    trace['end'] = end
+    return trace
+
+
+def parent_links(parents, end, rssi, period=30):
+    # Only the parents are known to be in range, assume a fair link in both directions
+    # for as long as the child keeps the parent, sampled every beacon period
+    links = []
+    by_child = {}
+    for t, parent, child in parents:
+        by_child.setdefault(child, []).append((t, parent))
+    for child, changes in by_child.items():
+        for (t, parent), (t_next, _) in zip(changes, changes[1:] + [(end, None)]):
+            while t <= t_next:
+                links.append((t, parent, child, rssi))
+                t += period
+    return links
+
+
+def write_trace(trace, testbed, rssi, out_file):
+    # Cooja times start with the simulation, testbed times with the first line of the log
+    origin = trace['start'] if testbed else 0
+
+    def ms(t):
+        return int(round((t - origin) * 1000))
+
+    nodes = dict(trace['nodes'])
+    for node in trace['first']:
+        nodes.setdefault(node, False)
+    booted = {node for _, node in trace['boots']}
+    # Nodes already running when the log started boot with their first line
+    boots = trace['boots'] + [(trace['first'][n], n) for n in nodes if n not in booted]
+
+    links = trace['links']
+    if not links:
+        links = parent_links(trace['parents'], trace['end'], rssi)
+
+    events = [(t, "boot {} {}".format(ms(t), node)) for t, node in boots]
+    events += [(t, "link {} {} {} {}".format(ms(t), a, b, r)) for t, a, b, r in links]
+    events += [(t, "{} {} {}".format(kind, ms(t), fields)) for t, kind, fields in trace['traffic']]
+    events.sort(key=lambda e: e[0])
+
+    with open(out_file, 'w') as f:
+        for node in sorted(nodes):
+            f.write("node {} {}\n".format(node, 1 if nodes[node] else 0))
+        for _, event in events:
+            f.write(event + "\n")
+        f.write("end {}\n".format(ms(trace['end'])))
+
+    sends = sum(1 for _, kind, _ in trace['traffic'] if kind == "send")
+    print("Nodes: {} ({} sinks), boots: {}".format(len(nodes), sum(nodes.values()), len(boots)))
+    print("Links: {} samples{}".format(len(links), "" if trace['links'] else " inferred from the parents"))
+    print("Messages: {} many-to-one, {} one-to-many".format(sends, len(trace['traffic']) - sends))
+    print("Duration: {:.1f} s".format((trace['end'] - trace['start']) if trace['end'] is not None else 0))
+    print("\nTrace saved in {}".format(out_file))
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('logfile', action="store", type=str,
+                        help="logfile of the run to be replayed.")
+    parser.add_argument('-t', '--testbed', action='store_true',
+                        help="flag for testbed experiments")
+    parser.add_argument('-o', '--output', type=str, default=None,
+                        help="trace file, <logfile>-trace.txt by default")
+    parser.add_argument('--rssi', type=int, default=-80,
+                        help="RSSI of the links inferred from the parents, when the beacons are not logged")
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+
+    args = parse_args()
+    if not os.path.isfile(args.logfile):
+        print("The logfile argument {} is not a file.".format(args.logfile))
+        sys.exit(1)
+
+    trace = parse_log(args.logfile, args.testbed, load_addr_id_map() if args.testbed else {})
+    if trace['start'] is None:
+        print("No log lines found in {}".format(args.logfile))
+        sys.exit(1)
+    if not trace['links'] and not trace['parents']:
+        print("No links found, enable LINK_TRACE_LOG (or TOPOLOGY_EVENTS_LOG) in params.h")
+        sys.exit(1)
+
+    out_file = args.output or "{}-trace.txt".format(os.path.splitext(args.logfile)[0])
+    write_trace(trace, args.testbed, args.rssi, out_file)
@@ -0,0 +1,422 @@
+/* Replay of a recorded run on the host: the protocol of every node runs on a virtual clock, under the
+ * links, boots and traffic extracted from a Cooja or testbed log by extract-trace.py. The nodes print
+ * a Cooja log on stdout, analyzed as usual by parse-stats.py and parse-topology.py.
+ *
+ * Trace format, one event per line, times in ms:
+ *   node <id> <sink>                           sink is 1 for the sinks
+ *   boot <time> <id>
+ *   link <time> <from> <to> <rssi>             <to> heard <from> with <rssi>
+ *   send <time> <id> <seqn> <class>            many-to-one message, class -1 if not logged
+ *   srsend <time> <sink> <dest> <seqn> <class> one-to-many message
+ *   end <time>
+ *
+ * Usage: replay [-s seed] [-w wakeup ms] [-l link timeout s] [-n] [-e end s] trace
+ *
+ * The parents of the nodes are checked every second for loops, the replay exits with status 2 if any formed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "sim.h"
+#include "lib/random.h"
+#include "protocol.h"
+#include "params.h"
+
+/* Application packet */
+typedef struct
+{
+  uint16_t seqn;
+}
+__attribute__((packed))
+app_msg;
+
+struct traffic
+{
+  struct sim_node *node;
+  linkaddr_t dest;
+  uint16_t seqn;
+  int tclass;
+};
+
+/* Period of the check of the parents for loops */
+#define LOOP_CHECK_PERIOD 1000000ULL
+
+static struct protocol_conn conns[SIM_MAX_NODES];
+static bool sinks[SIM_MAX_NODES];
+/* Nodes in a loop at the last check, nodes that entered a loop and checks that found one */
+static bool in_loop[SIM_MAX_NODES];
+static unsigned loop_entries;
+static unsigned loop_checks;
+
+static void sink_recv_cb(const linkaddr_t *originator, uint8_t hops);
+
+static void sink_bulk_recv_cb(const linkaddr_t *originator, const uint8_t *data,
+                              uint16_t offset, uint16_t length, bool complete, uint8_t hops);
+
+static void sink_delivered_cb(const linkaddr_t *dest, uint8_t id, bool acked);
+
+static void sr_recv_cb(struct protocol_conn *ptr, uint8_t hops);
+
+static struct protocol_callbacks sink_cb = {
+    .recv = sink_recv_cb,
+    .sr_recv = NULL,
+    .bulk_recv = sink_bulk_recv_cb,
+    .delivered = sink_delivered_cb,
+};
+static struct protocol_callbacks node_cb = {
+    .recv = NULL,
+    .sr_recv = sr_recv_cb,
+    .bulk_recv = NULL,
+    .delivered = NULL,
+};
+
+static struct protocol_conn *current_conn(void)
+{
+  return &conns[sim_current() - sim_nodes];
+}
+
+/* Same classes as app.c when the log does not report them */
+static uint8_t msg_class(uint16_t seqn, int tclass)
+{
+  if (tclass >= 0)
+  {
+    return tclass;
+  }
+#if TRAFFIC_CLASSES == 1 && APP_CRITICAL_INTERVAL > 0
+  if (seqn % APP_CRITICAL_INTERVAL == 0)
+  {
+    return TRAFFIC_CRITICAL;
+  }
+#endif
+  return TRAFFIC_NORMAL;
+}
+
+static void report_recv(const linkaddr_t *originator, const app_msg *msg, uint8_t hops)
+{
+#if LATENCY_TRACKING == 1
+  printf("App: recv from %02x:%02x seqn %u hops %u delay %u\n",
+         originator->u8[0], originator->u8[1], msg->seqn, hops, current_conn()->rx_delay);
+#else
+  printf("App: recv from %02x:%02x seqn %u hops %u\n",
+         originator->u8[0], originator->u8[1], msg->seqn, hops);
+#endif
+}
+
+static void sink_recv_cb(const linkaddr_t *originator, uint8_t hops)
+{
+  app_msg msg;
+  if (packetbuf_datalen() != sizeof(msg))
+  {
+    printf("App: wrong length: %d\n", packetbuf_datalen());
+    return;
+  }
+  memcpy(&msg, packetbuf_dataptr(), sizeof(msg));
+  report_recv(originator, &msg, hops);
+}
+
+static void sink_bulk_recv_cb(const linkaddr_t *originator, const uint8_t *data,
+                              uint16_t offset, uint16_t length, bool complete, uint8_t hops)
+{
+  app_msg msg;
+  uint16_t i;
+  if (!complete)
+  {
+    return;
+  }
+  for (i = 0; i + sizeof(msg) <= offset + length; i += sizeof(msg))
+  {
+    memcpy(&msg, data + i, sizeof(msg));
+    report_recv(originator, &msg, hops);
+  }
+}
+
+static void sink_delivered_cb(const linkaddr_t *dest, uint8_t id, bool acked)
+{
+  printf("App: reliable id %u to %02x:%02x %s\n", id, dest->u8[0], dest->u8[1], acked ? "acked" : "failed");
+}
+
+static void sr_recv_cb(struct protocol_conn *ptr, uint8_t hops)
+{
+  app_msg sr_msg;
+  if (packetbuf_datalen() != sizeof(app_msg))
+  {
+    printf("App: sr_recv wrong length: %d\n", packetbuf_datalen());
+    return;
+  }
+  memcpy(&sr_msg, packetbuf_dataptr(), sizeof(app_msg));
+#if LATENCY_TRACKING == 1
+  printf("App: sr_recv from sink seqn %u hops %u node metric %u delay %u\n",
+         sr_msg.seqn, hops, ptr->hop_to_sink, ptr->rx_delay);
+#else
+  printf("App: sr_recv from sink seqn %u hops %u node metric %u\n",
+         sr_msg.seqn, hops, ptr->hop_to_sink);
+#endif
+}
+
+/* A node booting again restarts the protocol from scratch, as after a reset of the device */
+static void boot(void *ptr)
+{
+  struct sim_node *node = ptr;
+  int index = node - sim_nodes;
+  if (node->booted)
+  {
+    sim_node_reset(node);
+    memset(&conns[index], 0, sizeof(struct protocol_conn));
+  }
+  else
+  {
+    sim_energest_start(node);
+  }
+  node->booted = true;
+  printf("Rime started with address %u.%u\n", node->addr.u8[0], node->addr.u8[1]);
+  if (sinks[index])
+  {
+    printf("App: I am sink %02x:%02x\n", node->addr.u8[0], node->addr.u8[1]);
+    open_protocol(&conns[index], COLLECT_CHANNEL, true, &sink_cb, sim_num_nodes);
+  }
+  else
+  {
+    printf("App: I am normal node %02x:%02x\n", node->addr.u8[0], node->addr.u8[1]);
+    open_protocol(&conns[index], COLLECT_CHANNEL, false, &node_cb, sim_num_nodes);
+  }
+}
+
+static void app_send(void *ptr)
+{
+  struct traffic *t = ptr;
+  app_msg msg = {.seqn = t->seqn};
+  uint8_t tclass = msg_class(t->seqn, t->tclass);
+  if (t->node->booted)
+  {
+    packetbuf_clear();
+    memcpy(packetbuf_dataptr(), &msg, sizeof(msg));
+    packetbuf_set_datalen(sizeof(msg));
+#if TRAFFIC_CLASSES == 1
+    printf("App: send seqn %d class %u\n", msg.seqn, tclass);
+#else
+    printf("App: send seqn %d\n", msg.seqn);
+#endif
+    send_sink(current_conn(), tclass);
+  }
+  free(t);
+}
+
+static void app_sr_send(void *ptr)
+{
+  struct traffic *t = ptr;
+  app_msg msg = {.seqn = t->seqn};
+  uint8_t tclass = msg_class(t->seqn, t->tclass);
+  int ret;
+  if (t->node->booted)
+  {
+    packetbuf_clear();
+    memcpy(packetbuf_dataptr(), &msg, sizeof(msg));
+    packetbuf_set_datalen(sizeof(msg));
+#if TRAFFIC_CLASSES == 1
+    printf("App: sink sending seqn %d to %02x:%02x class %u\n", msg.seqn, t->dest.u8[0], t->dest.u8[1], tclass);
+#else
+    printf("App: sink sending seqn %d to %02x:%02x\n", msg.seqn, t->dest.u8[0], t->dest.u8[1]);
+#endif
+#if RELIABLE_DOWNWARD == 1 && APP_DOWNWARD_RELIABLE == 1
+    ret = send_node_reliable(current_conn(), &t->dest, tclass);
+    if (ret > 0)
+    {
+      printf("App: reliable id %d seqn %d\n", ret, msg.seqn);
+    }
+#else
+    ret = send_node(current_conn(), &t->dest, tclass);
+#endif
+    if (ret <= 0)
+    {
+      printf("App: sink could not send seqn %d to %02x:%02x\n", msg.seqn, t->dest.u8[0], t->dest.u8[1]);
+    }
+  }
+  free(t);
+}
+
+static struct traffic *new_traffic(unsigned id, unsigned seqn, int tclass, int line)
+{
+  struct traffic *t = calloc(1, sizeof(struct traffic));
+  if (t == NULL || (t->node = sim_node_by_id(id)) == NULL)
+  {
+    fprintf(stderr, "Replay: unknown node %u at line %d\n", id, line);
+    free(t);
+    return NULL;
+  }
+  t->seqn = seqn;
+  t->tclass = tclass;
+  return t;
+}
+
+/* Returns the end of the trace in us, 0 if it could not be loaded */
+static unsigned long long load_trace(const char *name)
+{
+  FILE *f = fopen(name, "r");
+  char buf[128];
+  unsigned long long time, end = 0, last = 0;
+  unsigned id, to, seqn, sink;
+  int rssi, tclass, line = 0, links = 0, traffic = 0;
+  if (f == NULL)
+  {
+    fprintf(stderr, "Replay: cannot open %s\n", name);
+    return 0;
+  }
+  while (fgets(buf, sizeof(buf), f) != NULL)
+  {
+    struct traffic *t;
+    line++;
+    if (sscanf(buf, "%*s %llu", &time) == 1 && time > last)
+    {
+      last = time;
+    }
+    if (sscanf(buf, "node %u %u", &id, &sink) == 2)
+    {
+      if (sim_num_nodes == SIM_MAX_NODES || id == 0 || id > 255 || sim_node_by_id(id) != NULL)
+      {
+        fprintf(stderr, "Replay: invalid node %u at line %d\n", id, line);
+        continue;
+      }
+      /* Cooja addresses, so that the output is parsed as a Cooja log */
+      sim_nodes[sim_num_nodes].id = id;
+      sim_nodes[sim_num_nodes].addr.u8[0] = id;
+      sinks[sim_num_nodes++] = sink != 0;
+    }
+    else if (sscanf(buf, "boot %llu %u", &time, &id) == 2)
+    {
+      if (sim_node_by_id(id) != NULL)
+      {
+        sim_schedule(time * 1000, boot, sim_node_by_id(id), sim_node_by_id(id));
+      }
+    }
+    else if (sscanf(buf, "link %llu %u %u %d", &time, &id, &to, &rssi) == 4)
+    {
+      links += sim_link_add(id, to, time * 1000, rssi);
+    }
+    else if (sscanf(buf, "send %llu %u %u %d", &time, &id, &seqn, &tclass) == 4)
+    {
+      if ((t = new_traffic(id, seqn, tclass, line)) != NULL)
+      {
+        sim_schedule(time * 1000, app_send, t, t->node);
+        traffic++;
+      }
+    }
+    else if (sscanf(buf, "srsend %llu %u %u %u %d", &time, &id, &to, &seqn, &tclass) == 5)
+    {
+      if ((t = new_traffic(id, seqn, tclass, line)) != NULL)
+      {
+        t->dest.u8[0] = to;
+        sim_schedule(time * 1000, app_sr_send, t, t->node);
+        traffic++;
+      }
+    }
+    else if (sscanf(buf, "end %llu", &time) == 1)
+    {
+      end = time * 1000;
+    }
+  }
+  fclose(f);
+  /* Without an end, stop after the last event */
+  if (end == 0)
+  {
+    end = last * 1000;
+  }
+  fprintf(stderr, "Replay: %d nodes, %d link samples, %d messages, %.1f s\n",
+          sim_num_nodes, links, traffic, end / 1e6);
+  if (links == 0)
+  {
+    fprintf(stderr, "Replay: no links in the trace, nodes will not hear each other\n");
+  }
+  return end;
+}
+
+/* A node whose chain of parents comes back to it is in a loop, reported when it enters the loop */
+static void check_loops(void *ptr)
+{
+  int i, hops;
+  bool found = false;
+  for (i = 0; i < sim_num_nodes; i++)
+  {
+    struct sim_node *next = &sim_nodes[i];
+    bool loop = false;
+    for (hops = 0; hops < sim_num_nodes && next->booted && !sinks[next - sim_nodes]; hops++)
+    {
+      next = sim_node_by_addr(&conns[next - sim_nodes].parent);
+      if (next == NULL)
+      {
+        break;
+      }
+      if (next == &sim_nodes[i])
+      {
+        loop = true;
+        break;
+      }
+    }
+    if (loop && !in_loop[i])
+    {
+      fprintf(stderr, "Replay: node %u in a parent loop at %.3f s, parent %02x:%02x\n", sim_nodes[i].id,
+              sim_now() / 1e6, conns[i].parent.u8[0], conns[i].parent.u8[1]);
+      loop_entries++;
+    }
+    in_loop[i] = loop;
+    found = found || loop;
+  }
+  if (found)
+  {
+    loop_checks++;
+  }
+  sim_schedule(sim_now() + LOOP_CHECK_PERIOD, check_loops, NULL, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long long end, duration = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:w:l:ne:")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      sim_config.seed = atoi(optarg);
+      break;
+    case 'w':
+      sim_config.wakeup_us = strtoull(optarg, NULL, 10) * 1000;
+      break;
+    case 'l':
+      sim_config.link_timeout_us = strtoull(optarg, NULL, 10) * 1000000ULL;
+      break;
+    case 'n':
+      sim_config.lossless = true;
+      break;
+    case 'e':
+      duration = strtoull(optarg, NULL, 10) * 1000000ULL;
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-s seed] [-w wakeup ms] [-l link timeout s] [-n] [-e end s] trace\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind >= argc || sim_config.wakeup_us == 0)
+  {
+    fprintf(stderr, "Usage: %s [-s seed] [-w wakeup ms] [-l link timeout s] [-n] [-e end s] trace\n", argv[0]);
+    return 1;
+  }
+  random_init(sim_config.seed);
+  end = load_trace(argv[optind]);
+  if (sim_num_nodes == 0)
+  {
+    return 1;
+  }
+  if (duration > 0)
+  {
+    end = duration;
+  }
+  sim_schedule(LOOP_CHECK_PERIOD, check_loops, NULL, NULL);
+  sim_run(end);
+  if (loop_entries > 0)
+  {
+    fprintf(stderr, "Replay: %u nodes entered a parent loop, loops found by %u checks of %llu\n",
+            loop_entries, loop_checks, end / LOOP_CHECK_PERIOD);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,40 @@
+/* Host replacement of the Contiki headers included by the protocol, implemented by replay/sim.c */
+#ifndef REPLAY_CONTIKI_H
+#define REPLAY_CONTIKI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include "src/include/project-conf.h"
+
+/* 16 bit clock of the TMote Sky, build with REPLAY_CLOCK32 for the 32 bit clock of the Firefly */
+#ifdef REPLAY_CLOCK32
+typedef uint32_t clock_time_t;
+#else
+typedef uint16_t clock_time_t;
+#endif
+#define CLOCK_SECOND 128
+
+clock_time_t clock_time(void);
+unsigned long clock_seconds(void);
+
+/* Callback timers of the virtual clock, fired in the context of the node that set them */
+struct ctimer
+{
+  struct ctimer *next;
+  unsigned long long expires;
+  clock_time_t start;
+  clock_time_t interval;
+  void (*f)(void *);
+  void *ptr;
+  int node;
+};
+
+void ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr);
+void ctimer_reset(struct ctimer *c);
+void ctimer_restart(struct ctimer *c);
+void ctimer_stop(struct ctimer *c);
+int ctimer_expired(struct ctimer *c);
+
+#endif /* REPLAY_CONTIKI_H */
@@ -0,0 +1,13 @@
+#ifndef REPLAY_LEDS_H
+#define REPLAY_LEDS_H
+
+#define LEDS_GREEN 1
+#define LEDS_YELLOW 2
+#define LEDS_RED 4
+#define LEDS_ALL 7
+
+#define leds_on(l)
+#define leds_off(l)
+#define leds_toggle(l)
+
+#endif /* REPLAY_LEDS_H */
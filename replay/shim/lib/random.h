@@ -0,0 +1,9 @@
+#ifndef REPLAY_RANDOM_H
+#define REPLAY_RANDOM_H
+
+#define RANDOM_RAND_MAX 65535U
+
+void random_init(unsigned short seed);
+unsigned short random_rand(void);
+
+#endif /* REPLAY_RANDOM_H */
@@ -0,0 +1,15 @@
+#ifndef REPLAY_NETSTACK_H
+#define REPLAY_NETSTACK_H
+
+/* Status of the sent callbacks, as reported by the MAC */
+enum
+{
+  MAC_TX_OK,
+  MAC_TX_COLLISION,
+  MAC_TX_NOACK,
+  MAC_TX_DEFERRED,
+  MAC_TX_ERR,
+  MAC_TX_ERR_FATAL,
+};
+
+#endif /* REPLAY_NETSTACK_H */
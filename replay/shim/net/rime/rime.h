@@ -0,0 +1,88 @@
+/* Packet buffer and the Rime primitives used by the protocol, delivered by the radio model of replay/sim.c */
+#ifndef REPLAY_RIME_H
+#define REPLAY_RIME_H
+
+#include "contiki.h"
+#include "core/net/linkaddr.h"
+#include "net/netstack.h"
+
+#define PACKETBUF_SIZE 128
+#define PACKETBUF_HDR_SIZE 48
+
+enum
+{
+  PACKETBUF_ATTR_NONE,
+  PACKETBUF_ATTR_CHANNEL,
+  PACKETBUF_ATTR_RSSI,
+  PACKETBUF_ATTR_LINK_QUALITY,
+  PACKETBUF_ATTR_PACKET_TYPE,
+  PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS,
+  PACKETBUF_ATTR_MAC_SEQNO,
+  PACKETBUF_NUM_ATTRS
+};
+
+/* Addresses of the packet, the receiver is still set when the sent callbacks run */
+enum
+{
+  PACKETBUF_ADDR_SENDER,
+  PACKETBUF_ADDR_RECEIVER,
+  PACKETBUF_NUM_ADDRS
+};
+
+void packetbuf_clear(void);
+void *packetbuf_dataptr(void);
+void *packetbuf_hdrptr(void);
+uint16_t packetbuf_datalen(void);
+uint8_t packetbuf_hdrlen(void);
+uint16_t packetbuf_totlen(void);
+void packetbuf_set_datalen(uint16_t len);
+int packetbuf_hdralloc(int size);
+int packetbuf_hdrreduce(int size);
+int packetbuf_copyfrom(const void *from, uint16_t len);
+int packetbuf_copyto(void *to);
+int packetbuf_set_attr(uint8_t type, const uint16_t val);
+uint16_t packetbuf_attr(uint8_t type);
+int packetbuf_set_addr(uint8_t type, const linkaddr_t *addr);
+const linkaddr_t *packetbuf_addr(uint8_t type);
+
+struct queuebuf;
+struct queuebuf *queuebuf_new_from_packetbuf(void);
+void queuebuf_to_packetbuf(struct queuebuf *b);
+void queuebuf_free(struct queuebuf *b);
+
+struct broadcast_conn;
+struct unicast_conn;
+
+struct broadcast_callbacks
+{
+  void (*recv)(struct broadcast_conn *ptr, const linkaddr_t *sender);
+  void (*sent)(struct broadcast_conn *ptr, int status, int num_tx);
+};
+
+struct unicast_callbacks
+{
+  void (*recv)(struct unicast_conn *c, const linkaddr_t *from);
+  void (*sent)(struct unicast_conn *ptr, int status, int num_tx);
+};
+
+struct broadcast_conn
+{
+  const struct broadcast_callbacks *u;
+  uint16_t channel;
+};
+
+struct unicast_conn
+{
+  const struct unicast_callbacks *u;
+  uint16_t channel;
+};
+
+void broadcast_open(struct broadcast_conn *c, uint16_t channel, const struct broadcast_callbacks *u);
+void broadcast_close(struct broadcast_conn *c);
+int broadcast_send(struct broadcast_conn *c);
+
+void unicast_open(struct unicast_conn *c, uint16_t channel, const struct unicast_callbacks *u);
+void unicast_close(struct unicast_conn *c);
+int unicast_send(struct unicast_conn *c, const linkaddr_t *receiver);
+
+#endif /* REPLAY_RIME_H */
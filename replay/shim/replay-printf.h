@@ -0,0 +1,11 @@
+/* Included before every source of the replay: the lines printed by the nodes are prefixed
+ * with the virtual time and the node id, in the format of the Cooja logs */
+#ifndef REPLAY_PRINTF_H
+#define REPLAY_PRINTF_H
+
+#include <stdio.h>
+
+int replay_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define printf replay_printf
+
+#endif /* REPLAY_PRINTF_H */
@@ -0,0 +1,994 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "sim.h"
+#include "lib/random.h"
+#include "simple-energest.h"
+#include "src/include/persist.h"
+#include "src/include/backchannel.h"
+
+/* Default transmissions of the CSMA layer when the packet does not set PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS */
+#define SIM_MAC_TRANSMISSIONS 3
+/* Frames queued by the MAC of a node, further sends are refused */
+#define SIM_MAC_QUEUE 8
+/* 802.15.4 PHY and MAC overhead added to the Rime payload */
+#define SIM_FRAME_OVERHEAD 19
+/* Air time of a byte at 250 kbps */
+#define SIM_BYTE_US 32
+/* Latency of the wired backchannel between the sinks */
+#define SIM_BACKCHANNEL_US 10000
+
+struct sim_config sim_config = {
+    .wakeup_us = 125000,
+    .check_us = 500,
+    .link_timeout_us = 90 * 1000000ULL,
+    .prr_floor = -97,
+    .prr_good = -87,
+    .lossless = false,
+    .seed = 1,
+};
+struct sim_node sim_nodes[SIM_MAX_NODES];
+int sim_num_nodes;
+
+struct sim_event
+{
+  struct sim_event *next;
+  unsigned long long time;
+  void (*f)(void *);
+  void *ptr;
+  struct sim_node *node;
+};
+
+struct sim_frame
+{
+  struct sim_frame *next;
+  struct sim_node *src;
+  uint16_t generation;
+  bool unicast;
+  linkaddr_t dest;
+  uint8_t max_tx;
+  uint16_t length;
+  uint8_t data[PACKETBUF_SIZE];
+  /* Outcome, decided when the transmission starts */
+  int status;
+  int num_tx;
+  int8_t rssi;
+};
+
+struct link_sample
+{
+  unsigned long long time;
+  int8_t rssi;
+};
+
+struct link
+{
+  struct link_sample *samples;
+  int count;
+  int size;
+};
+
+struct stored_record
+{
+  struct stored_record *next;
+  uint8_t node;
+  char name[16];
+  uint16_t length;
+  uint8_t *data;
+};
+
+struct sink_channel
+{
+  const struct backchannel_callbacks *callbacks;
+  void *ptr;
+};
+
+struct backchannel_msg
+{
+  struct sim_node *sink;
+  bool route;
+  linkaddr_t child;
+  linkaddr_t parent;
+  uint16_t length;
+  uint8_t data[BACKCHANNEL_MAX_DATA];
+};
+
+static unsigned long long now;
+static struct sim_node *current;
+static struct sim_event *events;
+static struct ctimer *ctimers;
+/* Node generation, so that the frames on air before a reboot are discarded */
+static uint16_t generations[SIM_MAX_NODES];
+static struct link links[SIM_MAX_NODES][SIM_MAX_NODES];
+static struct stored_record *records;
+static struct sink_channel channels[SIM_MAX_NODES];
+static unsigned long radio_state = 1;
+static unsigned short random_state = 1;
+
+linkaddr_t linkaddr_node_addr;
+const linkaddr_t linkaddr_null = {{0, 0}};
+
+static void start_tx(struct sim_node *node);
+
+#pragma region Clock
+unsigned long long sim_now(void)
+{
+  return now;
+}
+
+static unsigned long long now_ticks(void)
+{
+  return now * CLOCK_SECOND / 1000000ULL;
+}
+
+/* First us of [ticks] */
+static unsigned long long ticks_to_us(unsigned long long ticks)
+{
+  return (ticks * 1000000ULL + CLOCK_SECOND - 1) / CLOCK_SECOND;
+}
+
+clock_time_t clock_time(void)
+{
+  return (clock_time_t)now_ticks();
+}
+
+unsigned long clock_seconds(void)
+{
+  return (unsigned long)(now / 1000000ULL);
+}
+#pragma endregion Clock
+
+#pragma region Events
+struct sim_node *sim_current(void)
+{
+  return current;
+}
+
+void sim_set_current(struct sim_node *node)
+{
+  current = node;
+  if (node != NULL)
+  {
+    linkaddr_copy(&linkaddr_node_addr, &node->addr);
+  }
+}
+
+struct sim_node *sim_node_by_id(uint8_t id)
+{
+  int i;
+  for (i = 0; i < sim_num_nodes; i++)
+  {
+    if (sim_nodes[i].id == id)
+    {
+      return &sim_nodes[i];
+    }
+  }
+  return NULL;
+}
+
+struct sim_node *sim_node_by_addr(const linkaddr_t *addr)
+{
+  int i;
+  for (i = 0; i < sim_num_nodes; i++)
+  {
+    if (linkaddr_cmp(&sim_nodes[i].addr, addr))
+    {
+      return &sim_nodes[i];
+    }
+  }
+  return NULL;
+}
+
+void sim_schedule(unsigned long long time, void (*f)(void *), void *ptr, struct sim_node *node)
+{
+  struct sim_event *e = malloc(sizeof(struct sim_event));
+  struct sim_event **p = &events;
+  if (e == NULL)
+  {
+    fprintf(stderr, "Replay: out of memory\n");
+    exit(1);
+  }
+  e->time = time;
+  e->f = f;
+  e->ptr = ptr;
+  e->node = node;
+  /* After the events at the same time, so that they run in order */
+  while (*p != NULL && (*p)->time <= time)
+  {
+    p = &(*p)->next;
+  }
+  e->next = *p;
+  *p = e;
+}
+
+void sim_run(unsigned long long end)
+{
+  while (events != NULL || ctimers != NULL)
+  {
+    unsigned long long timer_time = ctimers != NULL ? ticks_to_us(ctimers->expires) : ~0ULL;
+    unsigned long long event_time = events != NULL ? events->time : ~0ULL;
+    if (timer_time <= event_time)
+    {
+      struct ctimer *c = ctimers;
+      if (timer_time > end)
+      {
+        break;
+      }
+      now = timer_time;
+      ctimers = c->next;
+      c->next = NULL;
+      sim_set_current(c->node >= 0 ? &sim_nodes[c->node] : NULL);
+      c->f(c->ptr);
+    }
+    else
+    {
+      struct sim_event *e = events;
+      if (event_time > end)
+      {
+        break;
+      }
+      now = event_time;
+      events = e->next;
+      sim_set_current(e->node);
+      e->f(e->ptr);
+      free(e);
+    }
+    sim_set_current(NULL);
+  }
+  now = end;
+}
+#pragma endregion Events
+
+#pragma region Ctimer
+static bool ctimer_remove(struct ctimer *c)
+{
+  struct ctimer **p;
+  for (p = &ctimers; *p != NULL; p = &(*p)->next)
+  {
+    if (*p == c)
+    {
+      *p = c->next;
+      c->next = NULL;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void ctimer_insert(struct ctimer *c)
+{
+  struct ctimer **p = &ctimers;
+  ctimer_remove(c);
+  while (*p != NULL && (*p)->expires <= c->expires)
+  {
+    p = &(*p)->next;
+  }
+  c->next = *p;
+  *p = c;
+}
+
+void ctimer_set(struct ctimer *c, clock_time_t t, void (*f)(void *), void *ptr)
+{
+  c->f = f;
+  c->ptr = ptr;
+  c->interval = t;
+  c->node = current != NULL ? (int)(current - sim_nodes) : -1;
+  c->expires = now_ticks() + t;
+  ctimer_insert(c);
+}
+
+void ctimer_reset(struct ctimer *c)
+{
+  c->expires += c->interval;
+  ctimer_insert(c);
+}
+
+void ctimer_restart(struct ctimer *c)
+{
+  c->expires = now_ticks() + c->interval;
+  ctimer_insert(c);
+}
+
+void ctimer_stop(struct ctimer *c)
+{
+  ctimer_remove(c);
+}
+
+int ctimer_expired(struct ctimer *c)
+{
+  struct ctimer *t;
+  for (t = ctimers; t != NULL; t = t->next)
+  {
+    if (t == c)
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+#pragma endregion Ctimer
+
+#pragma region Packetbuf
+static uint8_t packetbuf[PACKETBUF_HDR_SIZE + PACKETBUF_SIZE];
+static uint16_t buflen, bufptr;
+static uint8_t hdrptr;
+static uint16_t attrs[PACKETBUF_NUM_ATTRS];
+static linkaddr_t addrs[PACKETBUF_NUM_ADDRS];
+
+void packetbuf_clear(void)
+{
+  buflen = bufptr = 0;
+  hdrptr = PACKETBUF_HDR_SIZE;
+  memset(attrs, 0, sizeof(attrs));
+  memset(addrs, 0, sizeof(addrs));
+}
+
+void *packetbuf_dataptr(void)
+{
+  return &packetbuf[PACKETBUF_HDR_SIZE + bufptr];
+}
+
+void *packetbuf_hdrptr(void)
+{
+  return &packetbuf[hdrptr];
+}
+
+uint16_t packetbuf_datalen(void)
+{
+  return buflen;
+}
+
+uint8_t packetbuf_hdrlen(void)
+{
+  return PACKETBUF_HDR_SIZE - hdrptr;
+}
+
+uint16_t packetbuf_totlen(void)
+{
+  return packetbuf_hdrlen() + packetbuf_datalen();
+}
+
+void packetbuf_set_datalen(uint16_t len)
+{
+  buflen = len;
+}
+
+int packetbuf_hdralloc(int size)
+{
+  if (hdrptr >= size && packetbuf_totlen() + size <= PACKETBUF_SIZE)
+  {
+    hdrptr -= size;
+    return 1;
+  }
+  return 0;
+}
+
+int packetbuf_hdrreduce(int size)
+{
+  if (buflen < size)
+  {
+    return 0;
+  }
+  bufptr += size;
+  buflen -= size;
+  return 1;
+}
+
+int packetbuf_copyfrom(const void *from, uint16_t len)
+{
+  uint16_t l = len < PACKETBUF_SIZE ? len : PACKETBUF_SIZE;
+  packetbuf_clear();
+  memcpy(packetbuf_dataptr(), from, l);
+  buflen = l;
+  return l;
+}
+
+int packetbuf_copyto(void *to)
+{
+  if (packetbuf_totlen() > PACKETBUF_SIZE)
+  {
+    return 0;
+  }
+  memcpy(to, packetbuf_hdrptr(), packetbuf_hdrlen());
+  memcpy((uint8_t *)to + packetbuf_hdrlen(), packetbuf_dataptr(), buflen);
+  return packetbuf_totlen();
+}
+
+int packetbuf_set_attr(uint8_t type, const uint16_t val)
+{
+  attrs[type] = val;
+  return 1;
+}
+
+uint16_t packetbuf_attr(uint8_t type)
+{
+  return attrs[type];
+}
+
+int packetbuf_set_addr(uint8_t type, const linkaddr_t *addr)
+{
+  linkaddr_copy(&addrs[type], addr);
+  return 1;
+}
+
+const linkaddr_t *packetbuf_addr(uint8_t type)
+{
+  return &addrs[type];
+}
+
+struct queuebuf
+{
+  uint16_t length;
+  uint16_t attrs[PACKETBUF_NUM_ATTRS];
+  uint8_t data[PACKETBUF_SIZE];
+};
+
+struct queuebuf *queuebuf_new_from_packetbuf(void)
+{
+  struct queuebuf *b = malloc(sizeof(struct queuebuf));
+  if (b != NULL)
+  {
+    b->length = packetbuf_copyto(b->data);
+    memcpy(b->attrs, attrs, sizeof(attrs));
+  }
+  return b;
+}
+
+void queuebuf_to_packetbuf(struct queuebuf *b)
+{
+  packetbuf_copyfrom(b->data, b->length);
+  memcpy(attrs, b->attrs, sizeof(attrs));
+}
+
+void queuebuf_free(struct queuebuf *b)
+{
+  free(b);
+}
+#pragma endregion Packetbuf
+
+#pragma region Radio
+/* 30 random bits, enough for the strobe durations in us */
+static unsigned long radio_rand(void)
+{
+  unsigned long r;
+  radio_state = radio_state * 1103515245UL + 12345UL;
+  r = (radio_state >> 16) & 0x7FFF;
+  radio_state = radio_state * 1103515245UL + 12345UL;
+  return (r << 15) | ((radio_state >> 16) & 0x7FFF);
+}
+
+bool sim_link_add(uint8_t from, uint8_t to, unsigned long long time, int8_t rssi)
+{
+  struct sim_node *a = sim_node_by_id(from);
+  struct sim_node *b = sim_node_by_id(to);
+  struct link *l;
+  int i;
+  if (a == NULL || b == NULL || a == b)
+  {
+    return false;
+  }
+  l = &links[a - sim_nodes][b - sim_nodes];
+  if (l->count == l->size)
+  {
+    struct link_sample *samples = realloc(l->samples, (l->size + 16) * sizeof(struct link_sample));
+    if (samples == NULL)
+    {
+      return false;
+    }
+    l->samples = samples;
+    l->size += 16;
+  }
+  /* Keep the samples sorted by time, they are mostly appended */
+  for (i = l->count; i > 0 && l->samples[i - 1].time > time; i--)
+  {
+    l->samples[i] = l->samples[i - 1];
+  }
+  l->samples[i].time = time;
+  l->samples[i].rssi = rssi;
+  l->count++;
+  return true;
+}
+
+/* RSSI of the link from [a] to [b] at the current time, false if it is down. The sinks do not log the beacons,
+ * links heard in a single direction are assumed symmetric */
+static bool link_rssi(struct sim_node *a, struct sim_node *b, int8_t *rssi)
+{
+  struct link *l = &links[a - sim_nodes][b - sim_nodes];
+  int lo = 0, hi;
+  unsigned long long distance;
+  if (l->count == 0)
+  {
+    l = &links[b - sim_nodes][a - sim_nodes];
+  }
+  if (l->count == 0)
+  {
+    return false;
+  }
+  /* Closest sample to the current time */
+  hi = l->count - 1;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (l->samples[mid].time < now)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  if (lo > 0 && now - l->samples[lo - 1].time < (l->samples[lo].time > now ? l->samples[lo].time - now : now - l->samples[lo].time))
+  {
+    lo--;
+  }
+  distance = l->samples[lo].time > now ? l->samples[lo].time - now : now - l->samples[lo].time;
+  if (distance > sim_config.link_timeout_us)
+  {
+    return false;
+  }
+  *rssi = l->samples[lo].rssi;
+  return true;
+}
+
+/* Draw the reception of a frame from [a] to [b] */
+static bool link_receives(struct sim_node *a, struct sim_node *b, int8_t *rssi)
+{
+  long prr;
+  if (!b->booted || !link_rssi(a, b, rssi))
+  {
+    return false;
+  }
+  if (sim_config.lossless)
+  {
+    return true;
+  }
+  prr = 1000L * (*rssi - sim_config.prr_floor) / (sim_config.prr_good - sim_config.prr_floor);
+  return (long)(radio_rand() % 1000) < prr;
+}
+
+static unsigned long long airtime(struct sim_frame *frame)
+{
+  return (unsigned long long)(frame->length + SIM_FRAME_OVERHEAD) * SIM_BYTE_US;
+}
+
+static struct sim_frame *new_frame(bool unicast, const linkaddr_t *dest)
+{
+  struct sim_frame *frame;
+  struct sim_frame **p;
+  int queued = 0;
+  for (p = &current->queue; *p != NULL; p = &(*p)->next)
+  {
+    queued++;
+  }
+  if (queued >= SIM_MAC_QUEUE || (frame = malloc(sizeof(struct sim_frame))) == NULL)
+  {
+    return NULL;
+  }
+  frame->next = NULL;
+  frame->src = current;
+  frame->generation = generations[current - sim_nodes];
+  frame->unicast = unicast;
+  linkaddr_copy(&frame->dest, dest);
+  frame->length = packetbuf_copyto(frame->data);
+  frame->max_tx = unicast ? packetbuf_attr(PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS) : 1;
+  if (frame->max_tx == 0)
+  {
+    frame->max_tx = SIM_MAC_TRANSMISSIONS;
+  }
+  *p = frame;
+  if (!current->tx_busy)
+  {
+    start_tx(current);
+  }
+  return frame;
+}
+
+static void tx_done(void *ptr)
+{
+  struct sim_frame *frame = ptr;
+  struct sim_node *src = frame->src;
+  int i;
+  if (frame->generation != generations[src - sim_nodes])
+  {
+    /* The sender rebooted while the frame was on air */
+    free(frame);
+    return;
+  }
+  src->queue = frame->next;
+  if (frame->unicast)
+  {
+    struct sim_node *dest = sim_node_by_addr(&frame->dest);
+    if (frame->status == MAC_TX_OK && dest != NULL && dest->booted && dest->uc != NULL)
+    {
+      sim_set_current(dest);
+      dest->rx_us += airtime(frame);
+      packetbuf_copyfrom(frame->data, frame->length);
+      packetbuf_set_attr(PACKETBUF_ATTR_RSSI, (uint16_t)frame->rssi);
+      packetbuf_set_addr(PACKETBUF_ADDR_SENDER, &src->addr);
+      packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &frame->dest);
+      dest->uc->u->recv(dest->uc, &src->addr);
+    }
+    sim_set_current(src);
+    if (src->uc != NULL && src->uc->u->sent != NULL)
+    {
+      /* As the CSMA layer, the packet just sent is back in the packetbuf */
+      packetbuf_copyfrom(frame->data, frame->length);
+      packetbuf_set_addr(PACKETBUF_ADDR_SENDER, &src->addr);
+      packetbuf_set_addr(PACKETBUF_ADDR_RECEIVER, &frame->dest);
+      src->uc->u->sent(src->uc, frame->status, frame->num_tx);
+    }
+  }
+  else
+  {
+    for (i = 0; i < sim_num_nodes; i++)
+    {
+      struct sim_node *dest = &sim_nodes[i];
+      int8_t rssi;
+      if (dest == src || dest->bc == NULL || !link_receives(src, dest, &rssi))
+      {
+        continue;
+      }
+      sim_set_current(dest);
+      dest->rx_us += airtime(frame);
+      packetbuf_copyfrom(frame->data, frame->length);
+      packetbuf_set_attr(PACKETBUF_ATTR_RSSI, (uint16_t)rssi);
+      packetbuf_set_addr(PACKETBUF_ADDR_SENDER, &src->addr);
+      dest->bc->u->recv(dest->bc, &src->addr);
+    }
+    sim_set_current(src);
+    if (src->bc != NULL && src->bc->u->sent != NULL)
+    {
+      src->bc->u->sent(src->bc, MAC_TX_OK, 1);
+    }
+  }
+  free(frame);
+  if (src->queue != NULL)
+  {
+    start_tx(src);
+  }
+  else
+  {
+    src->tx_busy = false;
+  }
+}
+
+/* Decide the outcome of the first frame queued by [node], it is delivered when the strobe ends.
+ * Unicast frames are strobed until the receiver wakes up and acknowledges them, a missing
+ * acknowledgement costs a whole wake up interval. Broadcast frames are strobed for a whole interval */
+static void start_tx(struct sim_node *node)
+{
+  struct sim_frame *frame = node->queue;
+  unsigned long long duration = 0;
+  unsigned long long air = airtime(frame);
+  node->tx_busy = true;
+  if (frame->unicast)
+  {
+    struct sim_node *dest = sim_node_by_addr(&frame->dest);
+    frame->status = MAC_TX_NOACK;
+    for (frame->num_tx = 1;; frame->num_tx++)
+    {
+      if (dest != NULL && dest->uc != NULL && link_receives(node, dest, &frame->rssi))
+      {
+        duration += air + radio_rand() % sim_config.wakeup_us;
+        frame->status = MAC_TX_OK;
+        break;
+      }
+      duration += air + sim_config.wakeup_us;
+      if (frame->num_tx >= frame->max_tx)
+      {
+        break;
+      }
+    }
+  }
+  else
+  {
+    frame->status = MAC_TX_OK;
+    frame->num_tx = 1;
+    duration = air + sim_config.wakeup_us;
+  }
+  node->tx_us += duration;
+  sim_schedule(now + duration, tx_done, frame, NULL);
+}
+
+void broadcast_open(struct broadcast_conn *c, uint16_t channel, const struct broadcast_callbacks *u)
+{
+  c->u = u;
+  c->channel = channel;
+  current->bc = c;
+}
+
+void broadcast_close(struct broadcast_conn *c)
+{
+  current->bc = NULL;
+}
+
+int broadcast_send(struct broadcast_conn *c)
+{
+  return new_frame(false, &linkaddr_null) != NULL;
+}
+
+void unicast_open(struct unicast_conn *c, uint16_t channel, const struct unicast_callbacks *u)
+{
+  c->u = u;
+  c->channel = channel;
+  current->uc = c;
+}
+
+void unicast_close(struct unicast_conn *c)
+{
+  current->uc = NULL;
+}
+
+int unicast_send(struct unicast_conn *c, const linkaddr_t *receiver)
+{
+  return new_frame(true, receiver) != NULL;
+}
+#pragma endregion Radio
+
+#pragma region Node
+void sim_node_reset(struct sim_node *node)
+{
+  struct ctimer **p = &ctimers;
+  struct sim_frame *frame;
+  int index = node - sim_nodes;
+  while (*p != NULL)
+  {
+    if ((*p)->node == index)
+    {
+      *p = (*p)->next;
+    }
+    else
+    {
+      p = &(*p)->next;
+    }
+  }
+  /* The frame on air is freed when its transmission ends */
+  frame = node->queue;
+  if (frame != NULL && node->tx_busy)
+  {
+    frame = frame->next;
+  }
+  while (frame != NULL)
+  {
+    struct sim_frame *next = frame->next;
+    free(frame);
+    frame = next;
+  }
+  node->queue = NULL;
+  generations[index]++;
+  node->tx_busy = false;
+  node->bc = NULL;
+  node->uc = NULL;
+  node->energest_cnt = 0;
+  channels[index].callbacks = NULL;
+}
+
+static void energest_report(void *ptr)
+{
+  struct sim_node *node = ptr;
+  unsigned long long listen = SIM_ENERGEST_PERIOD * sim_config.check_us / sim_config.wakeup_us;
+  unsigned long long radio = node->tx_us + node->rx_us + listen;
+  if (node->booted)
+  {
+    /* Only the radio is modelled, the whole period is accounted as LPM */
+    node->radio_permille = radio * 1000 / SIM_ENERGEST_PERIOD;
+    printf("Energest: %u %lu %lu %lu %lu\n", node->energest_cnt++, 0UL, (unsigned long)SIM_ENERGEST_PERIOD,
+           (unsigned long)node->tx_us, (unsigned long)(node->rx_us + listen));
+  }
+  node->tx_us = 0;
+  node->rx_us = 0;
+  sim_schedule(now + SIM_ENERGEST_PERIOD, energest_report, node, node);
+}
+
+void sim_energest_start(struct sim_node *node)
+{
+  sim_schedule(now + SIM_ENERGEST_PERIOD, energest_report, node, node);
+}
+
+uint16_t simple_energest_radio_permille(void)
+{
+  return current->radio_permille;
+}
+#pragma endregion Node
+
+#pragma region Platform
+void linkaddr_copy(linkaddr_t *dest, const linkaddr_t *from)
+{
+  memcpy(dest, from, LINKADDR_SIZE);
+}
+
+int linkaddr_cmp(const linkaddr_t *addr1, const linkaddr_t *addr2)
+{
+  return memcmp(addr1, addr2, LINKADDR_SIZE) == 0;
+}
+
+void linkaddr_set_node_addr(linkaddr_t *addr)
+{
+  linkaddr_copy(&linkaddr_node_addr, addr);
+}
+
+void random_init(unsigned short seed)
+{
+  random_state = seed != 0 ? seed : 1;
+  radio_state = seed;
+}
+
+/* Galois LFSR, shared by all the nodes */
+unsigned short random_rand(void)
+{
+  random_state = (random_state >> 1) ^ (-(random_state & 1u) & 0xB400u);
+  return random_state;
+}
+
+/* Every node keeps its records across reboots, the checks of persist.c are not needed in memory */
+bool persist_save(const char *name, const void *data, uint16_t length)
+{
+  struct stored_record *r;
+  for (r = records; r != NULL; r = r->next)
+  {
+    if (r->node == current->id && strncmp(r->name, name, sizeof(r->name)) == 0)
+    {
+      break;
+    }
+  }
+  if (r == NULL)
+  {
+    if ((r = calloc(1, sizeof(struct stored_record))) == NULL)
+    {
+      return false;
+    }
+    r->node = current->id;
+    strncpy(r->name, name, sizeof(r->name) - 1);
+    r->next = records;
+    records = r;
+  }
+  free(r->data);
+  r->data = malloc(length);
+  r->length = r->data != NULL ? length : 0;
+  if (r->data != NULL)
+  {
+    memcpy(r->data, data, length);
+  }
+  return r->data != NULL;
+}
+
+int persist_load(const char *name, void *data, uint16_t max_length)
+{
+  struct stored_record *r;
+  for (r = records; r != NULL; r = r->next)
+  {
+    if (r->node == current->id && strncmp(r->name, name, sizeof(r->name)) == 0 && r->length <= max_length)
+    {
+      memcpy(data, r->data, r->length);
+      return r->length;
+    }
+  }
+  return -1;
+}
+
+/* MEM_STATS builds: the allocations of the protocol go straight to the libc, the RAM painting of mem-stats.c
+ * only makes sense on the motes */
+void *mem_stats_malloc(size_t size)
+{
+  return malloc(size);
+}
+
+void mem_stats_free(void *ptr)
+{
+  free(ptr);
+}
+
+/* The backchannel of the sinks is a perfect channel with a small latency */
+void backchannel_open(const struct backchannel_callbacks *callbacks, void *ptr)
+{
+  channels[current - sim_nodes].callbacks = callbacks;
+  channels[current - sim_nodes].ptr = ptr;
+}
+
+static void backchannel_deliver(void *ptr)
+{
+  struct backchannel_msg *msg = ptr;
+  struct sink_channel *channel = &channels[msg->sink - sim_nodes];
+  if (channel->callbacks != NULL)
+  {
+    if (msg->route)
+    {
+      channel->callbacks->route(channel->ptr, &msg->child, &msg->parent);
+    }
+    else
+    {
+      channel->callbacks->data(channel->ptr, &msg->child, msg->data, msg->length);
+    }
+  }
+  free(msg);
+}
+
+static void backchannel_post(struct sim_node *sink, bool route, const linkaddr_t *a, const linkaddr_t *b,
+                             const uint8_t *data, uint16_t length)
+{
+  struct backchannel_msg *msg = calloc(1, sizeof(struct backchannel_msg));
+  if (msg == NULL)
+  {
+    return;
+  }
+  msg->sink = sink;
+  msg->route = route;
+  linkaddr_copy(&msg->child, a);
+  if (b != NULL)
+  {
+    linkaddr_copy(&msg->parent, b);
+  }
+  msg->length = length;
+  memcpy(msg->data, data, length);
+  sim_schedule(now + SIM_BACKCHANNEL_US, backchannel_deliver, msg, sink);
+}
+
+void backchannel_send_route(const linkaddr_t *child, const linkaddr_t *parent)
+{
+  int i;
+  for (i = 0; i < sim_num_nodes; i++)
+  {
+    if (&sim_nodes[i] != current && channels[i].callbacks != NULL)
+    {
+      backchannel_post(&sim_nodes[i], true, child, parent, NULL, 0);
+    }
+  }
+}
+
+/* Every sink running the protocol is known to the others */
+bool backchannel_is_sink(const linkaddr_t *addr)
+{
+  struct sim_node *node = sim_node_by_addr(addr);
+  return node != NULL && channels[node - sim_nodes].callbacks != NULL;
+}
+
+bool backchannel_send_data(const linkaddr_t *sink, const linkaddr_t *dest, const uint8_t *data, uint16_t length)
+{
+  struct sim_node *node = sim_node_by_addr(sink);
+  if (length > BACKCHANNEL_MAX_DATA || node == NULL)
+  {
+    return false;
+  }
+  backchannel_post(node, false, dest, NULL, data, length);
+  return true;
+}
+#pragma endregion Platform
+
+#pragma region Log
+static char line[512];
+static size_t line_length;
+
+/* Lines of the nodes go to stdout as "<time us>\tID:<id>\t<line>", the messages of the replay to stderr */
+int replay_printf(const char *fmt, ...)
+{
+  char buf[256];
+  va_list ap;
+  int n, i;
+  va_start(ap, fmt);
+  n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  for (i = 0; i < n && i < (int)sizeof(buf) - 1; i++)
+  {
+    if (buf[i] != '\n')
+    {
+      if (line_length < sizeof(line) - 1)
+      {
+        line[line_length++] = buf[i];
+      }
+      continue;
+    }
+    line[line_length] = '\0';
+    if (current != NULL)
+    {
+      fprintf(stdout, "%llu\tID:%u\t%s\n", now, current->id, line);
+    }
+    else
+    {
+      fprintf(stderr, "%s\n", line);
+    }
+    line_length = 0;
+  }
+  return n;
+}
+#pragma endregion Log
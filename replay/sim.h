@@ -0,0 +1,71 @@
+/* Virtual clock and radio of the replay: every node runs the real protocol code, the
+ * simulator switches linkaddr_node_addr to the node handling each event */
+#ifndef SIM_H
+#define SIM_H
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#define SIM_MAX_NODES 64
+/* Period of the Energest reports, as simple-energest.c */
+#define SIM_ENERGEST_PERIOD (15 * 1000000ULL)
+
+struct sim_frame;
+
+struct sim_node
+{
+  uint8_t id;
+  linkaddr_t addr;
+  bool booted;
+  struct broadcast_conn *bc;
+  struct unicast_conn *uc;
+  /* MAC transmit queue, one frame on air at a time */
+  struct sim_frame *queue;
+  bool tx_busy;
+  /* Radio on time since the last Energest report, in us */
+  unsigned long long tx_us;
+  unsigned long long rx_us;
+  uint16_t radio_permille;
+  uint16_t energest_cnt;
+};
+
+struct sim_config
+{
+  /* ContikiMAC wake up interval: unicast frames are strobed until the receiver wakes up */
+  unsigned long long wakeup_us;
+  /* Radio on time of every channel check */
+  unsigned long long check_us;
+  /* A link sample is valid for this long around the time it was logged */
+  unsigned long long link_timeout_us;
+  /* Packet reception rate 0 at prr_floor dBm, 1 at prr_good dBm and above */
+  int prr_floor;
+  int prr_good;
+  bool lossless;
+  unsigned short seed;
+};
+
+extern struct sim_config sim_config;
+extern struct sim_node sim_nodes[SIM_MAX_NODES];
+extern int sim_num_nodes;
+
+/* Time of the virtual clock in us */
+unsigned long long sim_now(void);
+/* Node handling the current event, NULL between events */
+struct sim_node *sim_current(void);
+void sim_set_current(struct sim_node *node);
+struct sim_node *sim_node_by_id(uint8_t id);
+struct sim_node *sim_node_by_addr(const linkaddr_t *addr);
+
+/* Run [f] at [time] us in the context of [node], NULL for none. Events at the same time run in order */
+void sim_schedule(unsigned long long time, void (*f)(void *), void *ptr, struct sim_node *node);
+/* Process the events until [end] us, or until there are no more */
+void sim_run(unsigned long long end);
+
+/* The receiver [to] heard [from] with [rssi] at [time] us */
+bool sim_link_add(uint8_t from, uint8_t to, unsigned long long time, int8_t rssi);
+/* Forget the timers and the frames of [node], before booting it again */
+void sim_node_reset(struct sim_node *node);
+/* Start the periodic Energest reports of [node] */
+void sim_energest_start(struct sim_node *node);
+
+#endif /* SIM_H */
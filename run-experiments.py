@@ -0,0 +1,311 @@
+#!/usr/bin/env python3
+
+# Runs the headless Cooja scenarios for every combination of scenario, seed and
+# parameters, in parallel on all the cores. Every parameter set is built once
+# in its own copy of the project, every run has its own working directory.
+# The logs are analyzed with parse-stats.py and summarized in a single table.
+#
+# Results are cached in experiments/cache by a key made of the hash of the
+# firmware sources, the scenario, the seed and the parameters: a sweep only
+# runs the combinations that changed since the previous one.
+#
+# Parameters override the defines of src/include/params.h, the values must not
+# contain spaces or commas. A file of NAME=value lines applies to every run
+# with --conf, e.g. a profile written by tune-params.py.
+#
+# Examples:
+#   ./run-experiments.py -n 3
+#   ./run-experiments.py -s test_nogui_dynamic.csc --seeds 1,2,3,4 \
+#       -p "BEACON_PERIOD=(30*CLOCK_SECOND),(60*CLOCK_SECOND)" -p PATH_RECORDING=0,1
+
+from __future__ import division
+
+import re
+import os
+import sys
+import json
+import glob
+import shutil
+import hashlib
+import argparse
+import itertools
+import subprocess
+from concurrent.futures import ThreadPoolExecutor
+
+base_dir = os.path.dirname(os.path.abspath(__file__))
+default_scenarios = sorted(os.path.basename(f) for f in glob.glob(os.path.join(base_dir, "test_nogui*.csc")))
+
+# Metrics read from the output of parse-stats.py: (section, regex, name)
+metric_patterns = [
+    ("Data Collection Overall", r"Overall PDR = (?P<v>[\d.]+)%", "pdr"),
+    ("Source Routing Overall", r"Overall PDR = (?P<v>[\d.]+)%", "sr_pdr"),
+    ("Duty Cycle Overall", r"Average Duty Cycle: (?P<v>[\d.]+)%", "duty_cycle"),
+    ("Topology updates", r"Piggybacks updates: (?P<v>\d+)", "piggybacks"),
+    ("Topology updates", r"Dedicated updates: (?P<v>\d+)", "dedicated"),
+    ("Data Collection Latency", r"Overall: p50 = (?P<v>[\d.]+) ms", "latency_p50"),
+    ("Data Collection Latency", r"Overall: p50 = [\d.]+ ms, p95 = (?P<v>[\d.]+) ms", "latency_p95"),
+    ("Source Routing Latency", r"Overall: p50 = (?P<v>[\d.]+) ms", "sr_latency_p50"),
+]
+metric_names = ["pdr", "sr_pdr", "duty_cycle", "piggybacks", "dedicated", "latency_p50", "latency_p95", "sr_latency_p50"]
+
+
+def sha(*parts):
+    h = hashlib.sha256()
+    for part in parts:
+        h.update(part if isinstance(part, bytes) else str(part).encode())
+        h.update(b"\0")
+    return h.hexdigest()[:16]
+
+
+def firmware_hash():
+    # Everything the build depends on in the project
+    files = [os.path.join(base_dir, "Makefile")]
+    for root, _, names in os.walk(os.path.join(base_dir, "src")):
+        files += [os.path.join(root, name) for name in names]
+    parts = []
+    for path in sorted(files):
+        with open(path, 'rb') as f:
+            parts += [os.path.relpath(path, base_dir), f.read()]
+    return sha(*parts)
+
+
+def param_defines(params):
+    return " ".join("{}={}".format(k, v) for k, v in sorted(params.items()))
+
+
+def parse_stats_output(text):
+    metrics = {}
+    section = ""
+    for line in text.splitlines():
+        m = re.match(r"-----\s*(.*?)\s*-----", line)
+        if m:
+            section = m.group(1)
+            continue
+        for prefix, pattern, name in metric_patterns:
+            if name in metrics or not section.startswith(prefix):
+                continue
+            m = re.match(pattern, line)
+            if m:
+                metrics[name] = float(m.group("v"))
+    if "piggybacks" in metrics or "dedicated" in metrics:
+        metrics["control"] = metrics.get("piggybacks", 0) + metrics.get("dedicated", 0)
+    return metrics
+
+
+class Runner:
+
+    def __init__(self, contiki, out_dir, jobs, timeout, sinks):
+        self.contiki = os.path.abspath(contiki)
+        self.out_dir = os.path.abspath(out_dir)
+        self.jobs = jobs
+        self.timeout = timeout
+        self.sinks = sinks
+        self.fw_hash = firmware_hash()
+        self.cooja = os.path.join(self.contiki, "tools", "cooja", "dist", "cooja.jar")
+
+    def log(self, msg):
+        print(msg, flush=True)
+
+    def build(self, params):
+        # One copy of the project per parameter set, so that parallel builds do not share objects
+        key = sha(self.fw_hash, param_defines(params))
+        build_dir = os.path.join(self.out_dir, "builds", key)
+        firmware = os.path.join(build_dir, "app.sky")
+        if os.path.isfile(firmware):
+            return firmware
+        shutil.rmtree(build_dir, ignore_errors=True)
+        shutil.copytree(os.path.join(base_dir, "src"), os.path.join(build_dir, "src"))
+        shutil.copy(os.path.join(base_dir, "Makefile"), build_dir)
+        cmd = ["make", "-s", "TARGET=sky", "CONTIKI={}".format(self.contiki)]
+        if params:
+            cmd.append("PARAM_DEFINES={}".format(param_defines(params)))
+        res = subprocess.run(cmd, cwd=build_dir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        if res.returncode != 0 or not os.path.isfile(firmware):
+            with open(os.path.join(build_dir, "build.log"), 'wb') as f:
+                f.write(res.stdout)
+            raise RuntimeError("build of {} failed, see {}/build.log".format(param_defines(params) or "defaults", build_dir))
+        self.log("Built {} ({})".format(key, param_defines(params) or "defaults"))
+        return firmware
+
+    def run(self, scenario, seed, params, firmware):
+        # Scenarios are relative to the project, or absolute paths
+        with open(os.path.join(base_dir, scenario), 'r') as f:
+            csc = f.read()
+        name = os.path.basename(scenario)
+        key = sha(self.fw_hash, csc, seed, param_defines(params))
+        cache_dir = os.path.join(self.out_dir, "cache", key)
+        result_file = os.path.join(cache_dir, "results.json")
+        if os.path.isfile(result_file):
+            with open(result_file, 'r') as f:
+                return json.load(f), True
+
+        run_dir = os.path.join(self.out_dir, "runs", key)
+        shutil.rmtree(run_dir, ignore_errors=True)
+        os.makedirs(run_dir)
+        csc = re.sub(r"<randomseed>\d+</randomseed>", "<randomseed>{}</randomseed>".format(seed), csc)
+        with open(os.path.join(run_dir, name), 'w') as f:
+            f.write(csc)
+        # The scenarios load the firmware from their own directory
+        shutil.copy(firmware, os.path.join(run_dir, "app.sky"))
+
+        cmd = ["java", "-mx512m", "-jar", self.cooja, "-nogui={}".format(name), "-contiki={}".format(self.contiki)]
+        try:
+            res = subprocess.run(cmd, cwd=run_dir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, timeout=self.timeout)
+            output = res.stdout
+        except subprocess.TimeoutExpired as e:
+            output = e.stdout or b""
+        with open(os.path.join(run_dir, "cooja.out"), 'wb') as f:
+            f.write(output)
+        log_file = os.path.join(run_dir, "test.log")
+        if not os.path.isfile(log_file) or os.path.getsize(log_file) == 0:
+            raise RuntimeError("{} seed {} produced no log, see {}/cooja.out".format(name, seed, run_dir))
+
+        cmd = [sys.executable, os.path.join(base_dir, "parse-stats.py"), log_file]
+        if self.sinks:
+            cmd += ["-s", self.sinks]
+        res = subprocess.run(cmd, cwd=run_dir, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        stats = res.stdout.decode(errors='replace')
+        with open(os.path.join(run_dir, "stats.txt"), 'w') as f:
+            f.write(stats)
+        if res.returncode != 0:
+            raise RuntimeError("parse-stats.py failed on {}, see {}/stats.txt".format(log_file, run_dir))
+
+        result = {"scenario": name, "seed": seed, "params": params, "metrics": parse_stats_output(stats)}
+        # Only the analyzed logs are kept in the cache
+        shutil.rmtree(cache_dir, ignore_errors=True)
+        os.makedirs(os.path.dirname(cache_dir), exist_ok=True)
+        os.rename(run_dir, cache_dir)
+        for name in glob.glob(os.path.join(cache_dir, "*.sky")):
+            os.remove(name)
+        with open(result_file, 'w') as f:
+            json.dump(result, f, indent=2)
+        return result, False
+
+    def sweep(self, scenarios, seeds, param_sets):
+        # Build every parameter set first, then run everything else in parallel
+        with ThreadPoolExecutor(max_workers=self.jobs) as pool:
+            builds = list(pool.map(lambda p: self.build(p), param_sets))
+        runs = [(s, seed, p, fw) for p, fw in zip(param_sets, builds) for s in scenarios for seed in seeds]
+        results = []
+
+        def job(args):
+            scenario, seed, params, firmware = args
+            try:
+                result, cached = self.run(scenario, seed, params, firmware)
+            except RuntimeError as e:
+                self.log("Failed: {}".format(e))
+                return None
+            self.log("{} {} seed {} ({}): {}".format(
+                "Cached" if cached else "Done", os.path.basename(scenario), seed, param_defines(params) or "defaults",
+                ", ".join("{} {:.2f}".format(k, v) for k, v in sorted(result["metrics"].items()))))
+            results.append(result)
+            return result
+
+        with ThreadPoolExecutor(max_workers=self.jobs) as pool:
+            list(pool.map(job, runs))
+        return results
+
+
+def summarize(results, out_csv):
+    # Mean over the seeds of every scenario and parameter set
+    groups = {}
+    for r in results:
+        groups.setdefault((r["scenario"], param_defines(r["params"])), []).append(r["metrics"])
+    names = [n for n in metric_names + ["control"] if any(n in m for g in groups.values() for m in g)]
+
+    rows = []
+    for (scenario, params), metrics in sorted(groups.items()):
+        row = [scenario, params or "defaults", str(len(metrics))]
+        for name in names:
+            values = [m[name] for m in metrics if name in m]
+            row.append("{:.2f}".format(sum(values) / len(values)) if values else "-")
+        rows.append(row)
+
+    header = ["scenario", "params", "runs"] + names
+    widths = [max(len(str(x)) for x in col) for col in zip(header, *rows)]
+    print("\n----- Experiment Results (mean over the seeds) -----\n")
+    for row in [header] + rows:
+        print("  ".join(str(x).ljust(w) for x, w in zip(row, widths)))
+
+    with open(out_csv, 'w') as f:
+        f.write("\t".join(["scenario", "seed", "params"] + names) + "\n")
+        for r in sorted(results, key=lambda r: (r["scenario"], param_defines(r["params"]), r["seed"])):
+            f.write("\t".join([r["scenario"], str(r["seed"]), param_defines(r["params"]) or "defaults"] +
+                              [str(r["metrics"].get(n, "")) for n in names]) + "\n")
+    print("\nResults of every run saved in {}".format(out_csv))
+
+
+def load_conf(path):
+    # NAME=value lines, as read by the Makefile with PARAMS_CONF
+    params = {}
+    with open(path, 'r') as f:
+        for line in f:
+            line = re.sub(r"\s", "", line.split('#', 1)[0])
+            if '=' in line:
+                name, _, value = line.partition('=')
+                params[name] = value
+    return params
+
+
+def parse_params(specs):
+    # NAME=v1,v2 for every -p, all the combinations are run
+    names = []
+    values = []
+    for spec in specs:
+        name, _, vals = spec.partition('=')
+        names.append(name.strip())
+        values.append([v.strip() for v in vals.split(',') if v.strip()])
+    return [dict(zip(names, combo)) for combo in itertools.product(*values)]
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-s', '--scenario', type=str, action='append', default=[],
+                        help="Cooja scenario to run, all the test_nogui*.csc by default")
+    parser.add_argument('--seeds', type=str, default=None,
+                        help="comma separated random seeds")
+    parser.add_argument('-n', '--num-seeds', type=int, default=1,
+                        help="number of seeds, starting from 1, when --seeds is not given")
+    parser.add_argument('-p', '--param', type=str, action='append', default=[],
+                        help="NAME=v1,v2,... parameter of params.h to sweep")
+    parser.add_argument('-c', '--conf', type=str, default=None,
+                        help="file of NAME=value parameters applied to every run, as PARAMS_CONF of the Makefile")
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(),
+                        help="parallel builds and simulations")
+    parser.add_argument('--contiki', type=str, default=os.environ.get("CONTIKI", os.path.join(base_dir, "..", "..", "contiki")),
+                        help="Contiki tree with Cooja built, $CONTIKI or ../../contiki by default")
+    parser.add_argument('-o', '--out', type=str, default=os.path.join(base_dir, "experiments"),
+                        help="directory of the builds, runs and cache")
+    parser.add_argument('--timeout', type=int, default=None,
+                        help="seconds after which a simulation is stopped")
+    parser.add_argument('--sinks', type=str, default=None,
+                        help="sinks passed to parse-stats.py")
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+
+    args = parse_args()
+    scenarios = args.scenario or default_scenarios
+    for scenario in scenarios:
+        if not os.path.isfile(os.path.join(base_dir, scenario)):
+            print("The scenario {} is not a file of {}.".format(scenario, base_dir))
+            sys.exit(1)
+    seeds = [int(s) for s in args.seeds.split(',')] if args.seeds else list(range(1, args.num_seeds + 1))
+
+    runner = Runner(args.contiki, args.out, args.jobs, args.timeout, args.sinks)
+    if not os.path.isfile(runner.cooja):
+        print("Cooja not found in {}, build it with ant jar in tools/cooja.".format(runner.cooja))
+        sys.exit(1)
+
+    param_sets = parse_params(args.param)
+    if args.conf:
+        param_sets = [dict(load_conf(args.conf), **p) for p in param_sets]
+    print("{} scenarios x {} seeds x {} parameter sets, {} jobs".format(
+        len(scenarios), len(seeds), len(param_sets), args.jobs))
+    try:
+        results = runner.sweep(scenarios, seeds, param_sets)
+    except RuntimeError as e:
+        print(e)
+        sys.exit(1)
+    summarize(results, os.path.join(runner.out_dir, "results.csv"))
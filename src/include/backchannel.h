@@ -0,0 +1,40 @@
+#include "contiki.h"
+#include "core/net/linkaddr.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+// Wired backchannel between the sinks. Messages are text lines exchanged on the serial line,
+// the host bridge (backchannel.py) relays every line starting with BACKCHANNEL_PREFIX to the other sinks:
+//   BC route <child> <parent>
+//   BC data <sink> <dest> <payload in hex>
+//   BC sink <sink>                          announced by every sink when it opens the backchannel
+#define BACKCHANNEL_PREFIX "BC "
+#define BACKCHANNEL_ROUTE "route "
+#define BACKCHANNEL_DATA "data "
+#define BACKCHANNEL_SINK "sink "
+// maximum number of sinks remembered from their announcements
+#define BACKCHANNEL_MAX_SINKS 4
+// maximum payload handed over to another sink, bounded by the serial line buffer
+#define BACKCHANNEL_MAX_DATA 24
+
+struct backchannel_callbacks
+{
+    // another sink learned that [parent] is the parent of [child]
+    void (*route)(void *ptr, const linkaddr_t *child, const linkaddr_t *parent);
+    // another sink handed over [length] bytes to be delivered to [dest], attached to this sink
+    void (*data)(void *ptr, const linkaddr_t *dest, const uint8_t *data, uint16_t length);
+};
+
+/// start listening to the other sinks on the serial line, [ptr] is passed back to the callbacks
+void backchannel_open(const struct backchannel_callbacks *callbacks, void *ptr);
+
+/// share a route of the tree of this sink with the other sinks
+void backchannel_send_route(const linkaddr_t *child, const linkaddr_t *parent);
+
+/// whether [addr] is a sink that announced itself on the backchannel
+bool backchannel_is_sink(const linkaddr_t *addr);
+
+/// hand over [length] bytes to [sink], that delivers them to [dest]. Returns false if the payload is too long
+bool backchannel_send_data(const linkaddr_t *sink, const linkaddr_t *dest, const uint8_t *data, uint16_t length);
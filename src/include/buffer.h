@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include "mem-stats.h"
 
 #define BUF_READ 0
 #define BUF_WRITE 1
@@ -0,0 +1,73 @@
+#include "contiki.h"
+#include "core/net/linkaddr.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "params.h"
+#include "mem-stats.h"
+
+// header of every fragment, written at the beginning of the DATA_PACKET payload
+typedef struct fragment_header
+{
+    // identifies the bulk payload among the ones of the same source
+    uint8_t tag;
+    uint8_t index;
+    uint8_t count;
+} __attribute__((packed)) fragment_header;
+
+// sink only - reassembly of the bulk payload of a source
+typedef struct reassembly
+{
+    linkaddr_t source;
+    uint8_t tag;
+    // number of fragments of the payload, 0 if the buffer is free
+    uint8_t count;
+    // bitmap of the received fragments
+    uint32_t received;
+    // number of fragments already delivered in order to the app
+    uint8_t delivered;
+    // retransmission requests already sent
+    uint8_t retries;
+    // length of the last fragment, 0 until received
+    uint8_t last_length;
+    // timer used to request missing fragments
+    struct ctimer timer;
+    // owner of the buffer, passed back in the timer callback
+    void *owner;
+    uint8_t data[FRAGMENT_MAX_SIZE];
+} reassembly_buffer;
+
+// node only - bulk payload being sent in fragments
+typedef struct fragment_tx
+{
+    uint8_t *data;
+    uint16_t length;
+    uint8_t tag;
+    // bitmap of the fragments still to be sent
+    uint32_t pending;
+    // timer used to pace the fragments
+    struct ctimer timer;
+} fragment_tx;
+
+/// number of fragments needed to send [length] bytes
+uint8_t frag_count(uint16_t length);
+
+/// allocate a pool of [size] free reassembly buffers
+reassembly_buffer *frag_pool_alloc(uint8_t size, void *owner);
+
+/// retrieve the reassembly buffer of [source] and [tag], if [count] > 0 and no buffer is found try to take a free one. Returns NULL if not found.
+/// Buffers of completed payloads are returned as well, until they are reused
+reassembly_buffer *frag_pool_get(reassembly_buffer *pool, uint8_t size, const linkaddr_t *source, uint8_t tag, uint8_t count);
+
+/// store a fragment in the buffer. Returns false if the fragment is not valid for the buffer
+bool frag_store(reassembly_buffer *buf, uint8_t index, const void *data, uint8_t length);
+
+/// bitmap of the fragments still missing in the buffer
+uint32_t frag_missing(reassembly_buffer *buf);
+
+/// length of the payload received in order, up to the first missing fragment
+uint16_t frag_contiguous_length(reassembly_buffer *buf, uint8_t fragments);
+
+/// free the buffer so that it can be used for a new payload
+void frag_release(reassembly_buffer *buf);
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include "contiki.h"
 #include "net/rime/rime.h"
@@ -5,8 +6,25 @@
 #include <string.h>
 #define SOURCE_ROUTE_PACKET 0
 #define DATA_PACKET 1
+#define STORING_ROUTE_PACKET 2
+#define MULTI_ROUTE_PACKET 3
+// source routed packet carrying a protocol packet instead of app data
+#define SOURCE_ROUTE_CONTROL_PACKET 4
+#define FRAGMENT_NACK_PACKET 5
+// reliable one-to-many message, carried by a SOURCE_ROUTE_CONTROL_PACKET
+#define RELIABLE_PACKET 6
+// broadcast packets
+#define BEACON_PACKET 7
+// local repair request of a node that lost its parent
+#define REPAIR_REQUEST_PACKET 8
+// beacon sent in unicast in reply to a local repair request
+#define REPAIR_REPLY_PACKET 9
 
-// Allocate the required space and write the data in the header
-void _write_packet_header(uint8_t packet_id, void *data_ptr, size_t size);
+// the two most significant bits of the packet id carry the traffic class of the packet, see TRAFFIC_CLASSES
+#define PACKET_ID_MASK 0x3F
+#define PACKET_CLASS_SHIFT 6
+
+// Allocate the required space and write the data in the header. Returns 0 if the header does not fit
+int _write_packet_header(uint8_t packet_id, void *data_ptr, size_t size);
 // Read a packet id from the header and reduce the header
 void _read_packet_id(uint8_t *id);
\ No newline at end of file
@@ -1,24 +1,314 @@
+// every parameter can be overridden at build time, e.g. make PARAM_DEFINES="BEACON_PERIOD=(60*CLOCK_SECOND)",
+// or with a file of NAME=value lines: make PARAMS_CONF=dense.conf
+
 // enable many-to-one traffic
+#ifndef APP_UPWARD_TRAFFIC
 #define APP_UPWARD_TRAFFIC 1
+#endif
 // enable one-to-many traffic
+#ifndef APP_DOWNWARD_TRAFFIC
 #define APP_DOWNWARD_TRAFFIC 1
+#endif
+// send each one-to-many message to all the destinations at once instead of one destination per period
+#ifndef APP_DOWNWARD_MULTI_DEST
+#define APP_DOWNWARD_MULTI_DEST 0
+#endif
+// number of many-to-one readings batched in a single bulk message, 0 sends each reading on its own
+// requires FRAGMENTATION_ENABLED and APP_BULK_READINGS * sizeof(app_msg) <= FRAGMENT_MAX_SIZE
+#ifndef APP_BULK_READINGS
+#define APP_BULK_READINGS 0
+#endif
+
+// sink only - report the received packets with compact binary frames instead of text lines, see gateway.py
+#ifndef SINK_BINARY_REPORT
+#define SINK_BINARY_REPORT 0
+#endif
+
+// report periodically the heap used by the protocol, the stack high-water mark and the free RAM, see src/tools/mem-stats.h
+#ifndef MEM_STATS
+#define MEM_STATS 0
+#endif
+
+// log the parent changes of the nodes and the routing table changes of the sinks, analyzed by parse-topology.py
+#ifndef TOPOLOGY_EVENTS_LOG
+#define TOPOLOGY_EVENTS_LOG 0
+#endif
+// log the RSSI of every beacon received, the links of the run are rebuilt from them by replay/extract-trace.py
+#ifndef LINK_TRACE_LOG
+#define LINK_TRACE_LOG 0
+#endif
+
+// accumulate in the data and source routing headers the time packets spend queued in the forwarders, reported by the app in ms.
+// Only the time waiting in the protocol backlog is counted, the queue of the MAC is not: the figure is 0 unless
+// SLOTTED_SCHEDULE or TRAFFIC_CLASSES hold the packets in the backlog
+#ifndef LATENCY_TRACKING
+#define LATENCY_TRACKING 0
+#endif
 
+// traffic classes only - one message every APP_CRITICAL_INTERVAL is sent by the app with the critical class, 0 disables
+#ifndef APP_CRITICAL_INTERVAL
+#define APP_CRITICAL_INTERVAL 5
+#endif
+// reliable downward only - send the one-to-many messages with send_node_reliable
+#ifndef APP_DOWNWARD_RELIABLE
+#define APP_DOWNWARD_RELIABLE 1
+#endif
+
+#ifndef COLLECT_CHANNEL
 #define COLLECT_CHANNEL 0xAA
+#endif
 // RSSI threshold, under which a connection is discarded
+#ifndef RSSI_THRESHOLD
 #define RSSI_THRESHOLD -95
+#endif
 
+#ifndef MSG_INIT_DELAY
 #define MSG_INIT_DELAY (INIT_BEACON_DELAY + TOPOLOGY_UPDATE_DELAY + (5 * FORWARD_DELAY))
+#endif
 // period of the many-to-one messages
+#ifndef MSG_PERIOD
 #define MSG_PERIOD (30 * CLOCK_SECOND)
+#endif
 // period of the one-to-many messages
+#ifndef SR_MSG_PERIOD
 #define SR_MSG_PERIOD (15 * CLOCK_SECOND)
+#endif
 // initial beacon delay
+#ifndef INIT_BEACON_DELAY
 #define INIT_BEACON_DELAY (5 * CLOCK_SECOND)
+#endif
 
 // how much to wait after receiving a beacon and changing topology before sending a dedicated topology update
 // reducing the delay, increases responsitivity to topology updates but increases traffic as less piggybacked messages are used
+#ifndef TOPOLOGY_UPDATE_DELAY
 #define TOPOLOGY_UPDATE_DELAY (BEACON_PERIOD / 6)
+#endif
 // period of the topology reconstruction protocol
+#ifndef BEACON_PERIOD
 #define BEACON_PERIOD (CLOCK_SECOND * 30)
+#endif
+// downward routing mode: 0 source routes computed at the sink, 1 storing mode with per node next hop tables
+// in storing mode the sink falls back to source routing for destinations that could not be stored along the path
+#ifndef DOWNWARD_STORING_MODE
+#define DOWNWARD_STORING_MODE 0
+#endif
+// storing mode only - maximum number of descendants a node keeps next hop information for
+#ifndef STORING_TABLE_SIZE
+#define STORING_TABLE_SIZE 8
+#endif
+
+// record in the upward data packets the forwarders they traverse, the sink refreshes the whole path in its routing table
+// and forwarders whose parent has been recorded skip their dedicated topology update
+#ifndef PATH_RECORDING
+#define PATH_RECORDING 0
+#endif
+// path recording only - maximum number of forwarders recorded in a single packet
+#ifndef PATH_RECORD_MAX_DEPTH
+#define PATH_RECORD_MAX_DEPTH 8
+#endif
+// path recording only - one data packet every PATH_RECORD_SAMPLING sent by a node records its path
+#ifndef PATH_RECORD_SAMPLING
+#define PATH_RECORD_SAMPLING 2
+#endif
+
+// routes not refreshed for this many beacon epochs are removed from the routing tables, 0 disables the expiry.
+// Nodes that did not send anything to the sink for half of it send a dedicated topology update
+#ifndef ROUTE_EXPIRY_EPOCHS
+#define ROUTE_EXPIRY_EPOCHS 8
+#endif
+// a full routing table allowed to both grow and evict replaces an entry not refreshed for this many epochs instead of
+// growing. The younger entries are live routes, they are evicted only if the table cannot grow
+#ifndef RTABLE_EVICT_EPOCHS
+#define RTABLE_EVICT_EPOCHS (ROUTE_EXPIRY_EPOCHS > 4 ? ROUTE_EXPIRY_EPOCHS / 2 : 2)
+#endif
+
+// a node whose parent stops acknowledging its packets broadcasts a repair request, the neighbors with a shorter
+// path in the same epoch reply with a unicast beacon and the node reattaches without waiting for the next beacon flood
+#ifndef LOCAL_REPAIR
+#define LOCAL_REPAIR 0
+#endif
+// local repair only - consecutive unicasts not acknowledged by the parent before the node detaches from it
+#ifndef REPAIR_TX_FAILURES
+#define REPAIR_TX_FAILURES 2
+#endif
+// local repair only - repair requests broadcast before waiting for the next beacon
+#ifndef REPAIR_MAX_REQUESTS
+#define REPAIR_MAX_REQUESTS 3
+#endif
+// local repair only - how long the node waits for the replies before broadcasting another request
+#ifndef REPAIR_TIMEOUT
+#define REPAIR_TIMEOUT (2 * CLOCK_SECOND)
+#endif
+// local repair only - the replies are spread over this time, then the repaired node sends its topology update
+#ifndef REPAIR_REPLY_SPREAD
+#define REPAIR_REPLY_SPREAD (CLOCK_SECOND / 2)
+#endif
+
+// enable send_node_reliable: the destination acknowledges the message end-to-end along the collection tree
+// and the sink retransmits it after a timeout adapted to the route length
+#ifndef RELIABLE_DOWNWARD
+#define RELIABLE_DOWNWARD 0
+#endif
+// reliable downward only - messages waiting for their acknowledgement at the same time
+#ifndef RELIABLE_MAX_PENDING
+#define RELIABLE_MAX_PENDING 4
+#endif
+// reliable downward only - maximum payload of a reliable message
+#ifndef RELIABLE_MAX_PAYLOAD
+#define RELIABLE_MAX_PAYLOAD 32
+#endif
+// reliable downward only - retransmissions before reporting the failure to the app
+#ifndef RELIABLE_MAX_RETRIES
+#define RELIABLE_MAX_RETRIES 3
+#endif
+// reliable downward only - retransmission timeout of every hop of the route until the round trip is measured
+#ifndef RELIABLE_HOP_TIMEOUT
+#define RELIABLE_HOP_TIMEOUT (CLOCK_SECOND)
+#endif
+// reliable downward only - bounds of the retransmission timeouts
+#ifndef RELIABLE_MIN_HOP_TIMEOUT
+#define RELIABLE_MIN_HOP_TIMEOUT (CLOCK_SECOND / 8)
+#endif
+#ifndef RELIABLE_MAX_TIMEOUT
+#define RELIABLE_MAX_TIMEOUT (60 * CLOCK_SECOND)
+#endif
+
+// maximum number of nodes (destinations and relays) encoded in a multi destination header, larger sub-trees are split
+// across several packets. Further bounded by MULTI_ROUTE_HDR_ROOM, 8 entries of 3 bytes fit the default room
+#ifndef MULTI_ROUTE_MAX_NODES
+#define MULTI_ROUTE_MAX_NODES 8
+#endif
+// packetbuf header bytes available to the multi destination header, the rest is left to the Rime and MAC headers
+#ifndef MULTI_ROUTE_HDR_ROOM
+#define MULTI_ROUTE_HDR_ROOM (PACKETBUF_HDR_SIZE - 20)
+#endif
+
+// choose the parent combining hop count, link quality and the load advertised in the beacons
+#ifndef PARENT_LOAD_AWARE
+#define PARENT_LOAD_AWARE 0
+#endif
+// parent selection cost: PARENT_HOP_WEIGHT * hop_to_sink - PARENT_RSSI_WEIGHT * rssi + PARENT_LOAD_WEIGHT * load
+#ifndef PARENT_HOP_WEIGHT
+#define PARENT_HOP_WEIGHT 100
+#endif
+#ifndef PARENT_RSSI_WEIGHT
+#define PARENT_RSSI_WEIGHT 1
+#endif
+#ifndef PARENT_LOAD_WEIGHT
+#define PARENT_LOAD_WEIGHT 2
+#endif
+// load advertised in the beacons: LOAD_RADIO_WEIGHT * radio on time in per mille + LOAD_FORWARD_WEIGHT * packets forwarded during the last beacon period
+#ifndef LOAD_RADIO_WEIGHT
+#define LOAD_RADIO_WEIGHT 1
+#endif
+#ifndef LOAD_FORWARD_WEIGHT
+#define LOAD_FORWARD_WEIGHT 4
+#endif
+
+// enable bulk payloads sent to the sink in fragments with send_sink_bulk
+#ifndef FRAGMENTATION_ENABLED
+#define FRAGMENTATION_ENABLED 0
+#endif
+// maximum payload carried by a single fragment
+#ifndef FRAGMENT_PAYLOAD_SIZE
+#define FRAGMENT_PAYLOAD_SIZE 64
+#endif
+// maximum size of a bulk payload, at most 32 fragments
+#ifndef FRAGMENT_MAX_SIZE
+#define FRAGMENT_MAX_SIZE 320
+#endif
+// sink only - number of bulk payloads that can be reassembled at the same time
+#ifndef FRAGMENT_BUFFERS
+#define FRAGMENT_BUFFERS 2
+#endif
+// delay between two fragments sent by the same node
+#ifndef FRAGMENT_INTERVAL
+#define FRAGMENT_INTERVAL (CLOCK_SECOND / 4)
+#endif
+// how long the sink waits for the missing fragments of a payload before asking for them
+#ifndef FRAGMENT_TIMEOUT
+#define FRAGMENT_TIMEOUT (5 * CLOCK_SECOND)
+#endif
+// retransmission requests sent before discarding an incomplete payload
+#ifndef FRAGMENT_MAX_RETRIES
+#define FRAGMENT_MAX_RETRIES 3
+#endif
+
+// send the upward traffic in slots synchronized by the beacon flood, deeper nodes first so that packets cascade towards the sink
+#ifndef SLOTTED_SCHEDULE
+#define SLOTTED_SCHEDULE 0
+#endif
+// length of a slot, every depth gets one slot per frame
+#ifndef SLOT_LENGTH
+#define SLOT_LENGTH (CLOCK_SECOND / 2)
+#endif
+// deepest hop_to_sink with its own slot, deeper nodes share the first slot of the frame
+#ifndef SLOT_MAX_DEPTH
+#define SLOT_MAX_DEPTH 8
+#endif
+// length of the schedule frame. Keep it a power of two so that clock wraps do not shift the schedule
+#ifndef SLOT_FRAME_LENGTH
+#define SLOT_FRAME_LENGTH (SLOT_MAX_DEPTH * SLOT_LENGTH)
+#endif
+// time it takes for a beacon to be received by a neighbor, added to the sink clock at every hop
+#ifndef SLOT_HOP_CORRECTION
+#define SLOT_HOP_CORRECTION (CLOCK_SECOND / 32)
+#endif
+// slotted schedule and traffic classes only - maximum number of packets waiting in the transmit backlog.
+// With the slotted schedule a relay holds the packets of its whole subtree until its slot, the packets
+// that do not fit are sent ahead of the slot
+#ifndef TX_BACKLOG_SIZE
+#if SLOTTED_SCHEDULE == 1
+#define TX_BACKLOG_SIZE 8
+#else
+#define TX_BACKLOG_SIZE 4
+#endif
+#endif
+
+// carry a traffic class in the packet header. Forwarders hand a single packet at a time to the MAC and keep the
+// others in the transmit backlog, sending the most urgent class first. With the slotted schedule the classes order the slot backlog
+#ifndef TRAFFIC_CLASSES
+#define TRAFFIC_CLASSES 0
+#endif
+// traffic classes only - a queued packet is overtaken by at most this many more urgent packets, 0 for strict priority
+#ifndef TRAFFIC_MAX_OVERTAKES
+#define TRAFFIC_MAX_OVERTAKES 4
+#endif
+// traffic classes only - MAC transmissions allowed to the packets of every class
+#ifndef TRAFFIC_CRITICAL_TRANSMISSIONS
+#define TRAFFIC_CRITICAL_TRANSMISSIONS 7
+#endif
+#ifndef TRAFFIC_NORMAL_TRANSMISSIONS
+#define TRAFFIC_NORMAL_TRANSMISSIONS 3
+#endif
+#ifndef TRAFFIC_BULK_TRANSMISSIONS
+#define TRAFFIC_BULK_TRANSMISSIONS 2
+#endif
+
+// persistence only, see PERSIST_STATE in project-conf.h - delay used to batch the writes of the sink state
+#ifndef PERSIST_DELAY
+#define PERSIST_DELAY (10 * CLOCK_SECOND)
+#endif
+// persistence only - the sink saves its beacon seqn every PERSIST_SEQN_INTERVAL epochs and resumes past it after a reboot
+#ifndef PERSIST_SEQN_INTERVAL
+#define PERSIST_SEQN_INTERVAL 10
+#endif
+// persistence only - maximum number of sink routing entries saved
+#ifndef PERSIST_MAX_ROUTES
+#define PERSIST_MAX_ROUTES 32
+#endif
+
+// several sinks originate beacons, nodes join the cheapest tree. The sinks share their routes and hand over
+// the downward packets for the nodes of the other trees through the host backchannel, see backchannel.py
+#ifndef MULTI_SINK
+#define MULTI_SINK 0
+#endif
+// multi sink only - after this time without new beacons of its sink, a node joins the tree of another sink
+#ifndef SINK_TIMEOUT
+#define SINK_TIMEOUT (2 * BEACON_PERIOD + CLOCK_SECOND)
+#endif
+
 // random delay for forwarding a message
+#ifndef FORWARD_DELAY
 #define FORWARD_DELAY (random_rand() % (CLOCK_SECOND))
+#endif
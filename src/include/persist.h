@@ -0,0 +1,24 @@
+#include "contiki.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define PERSIST_MAGIC 0x5053
+// change whenever the layout of the persisted records changes, older records are discarded
+#define PERSIST_VERSION 3
+
+// header written before every persisted record
+typedef struct persist_header
+{
+    uint16_t magic;
+    uint8_t version;
+    uint16_t length;
+    uint16_t checksum;
+} __attribute__((packed)) persist_header;
+
+/// save [length] bytes of [data] in the flash file [name], replacing the previous record
+bool persist_save(const char *name, const void *data, uint16_t length);
+
+/// load the record of the flash file [name] into [data]. Returns the length of the record, -1 if missing or not valid
+int persist_load(const char *name, void *data, uint16_t max_length);
@@ -15,7 +15,15 @@
 
 #define NETSTACK_CONF_WITH_IPV6 0
 #define CC2538_RF_CONF_CHANNEL 26
+/* Persist the routing state in flash to resume quickly after a reboot */
+#ifndef PERSIST_STATE
+#define PERSIST_STATE 0
+#endif
+#if PERSIST_STATE == 1
+#define COFFEE_CONF_SIZE (4 * COFFEE_SECTOR_SIZE)
+#else
 #define COFFEE_CONF_SIZE 0
+#endif
 #define LPM_CONF_MAX_PM LPM_PM0
 #define NULLRDC_CONF_802154_AUTOACK 1
 
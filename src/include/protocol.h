@@ -8,7 +8,30 @@
 #include "routing-table.h"
 #include "buffer.h"
 #include "params.h"
+#include "mem-stats.h"
 #include "packet.h"
+#include "fragment.h"
+#include "persist.h"
+#include "backchannel.h"
+#include "reliable.h"
+
+// Traffic classes, see TRAFFIC_CLASSES. A lower value is more urgent
+#define TRAFFIC_CRITICAL 0
+#define TRAFFIC_NORMAL 1
+#define TRAFFIC_BULK 2
+
+// Packet waiting in the transmit backlog
+struct backlog_entry
+{
+  struct queuebuf *packet;
+  linkaddr_t next_hop;
+  // when the packet entered the backlog
+  clock_time_t queued_at;
+  // traffic class of the packet
+  uint8_t tclass;
+  // traffic classes only - number of more urgent packets sent while this one was waiting
+  uint8_t overtaken;
+};
 
 // Connection object
 struct protocol_conn
@@ -17,12 +40,28 @@ struct protocol_conn
   uint16_t nodes;
   // sink only - routing table
   routing_table *routing_table;
+  // storing mode only - descendant to next hop table
+  routing_table *storing_table;
+  // sink only - buffers used to reassemble bulk payloads
+  reassembly_buffer *reassembly;
+  // node only - bulk payload being sent in fragments
+  fragment_tx fragment_tx;
+  // sink only - reliable messages waiting for their acknowledgement
+  reliable_tx *reliable;
+  // sink only - round trip estimate of the reliable messages
+  reliable_rtt reliable_rtt;
+  // sink only - id of the last reliable message sent. Node only - id of the last reliable message delivered
+  uint8_t reliable_id;
+  // node only - sink beacon seqn carried by the last reliable message delivered, together with reliable_id
+  uint16_t reliable_seqn;
   // timer used to manage topology updates
   struct ctimer topology_timer;
   // whether the topology has been refreshed at the root during the current topology epoch
   bool topology_refreshed;
   // whether the topology is dirty and must be refreshed
   bool topology_dirty;
+  // path recording only - data packets sent since the last one recording its path
+  uint8_t path_record_count;
   // broadcast rime connection structure
   struct broadcast_conn bc;
   // unicast rime connection structure
@@ -37,10 +76,46 @@ struct protocol_conn
   uint16_t hop_to_sink;
   // link quality to the current parent
   int16_t parent_rssi;
+  // load advertised by the current parent
+  uint8_t parent_load;
+  // packets forwarded since the last beacon, used to compute the advertised load
+  uint16_t forwarded;
   // current topology beacon seqn
   uint16_t beacon_seqn;
+  // node only - beacon seqn of the last packet sent to the sink, that refreshed the route of the node
+  uint16_t refresh_seqn;
+  // local repair only - consecutive unicasts not acknowledged by the parent
+  uint8_t parent_failures;
+  // local repair only - repair requests broadcast since the node lost its parent, 0 while attached
+  uint8_t repair_requests;
+  // local repair only - timer of the repair requests of a detached node, or of the reply of an attached one
+  struct ctimer repair_timer;
+  // local repair only - neighbor waiting for the reply to its repair request
+  linkaddr_t repair_requester;
+  // multi sink only - sink at the root of the tree the node is attached to
+  linkaddr_t sink;
+  // multi sink only - when the last beacon of the current sink has been accepted
+  clock_time_t sink_time;
   // whether the node is the sink
   bool is_sink;
+  // when the packet being handled has been received
+  clock_time_t rx_time;
+  // traffic class of the packet being handled
+  uint8_t rx_class;
+  // traffic classes only - whether a packet has been handed to the MAC and its completion is pending
+  bool tx_busy;
+  // latency tracking only - time in ms the packet being delivered spent queued in the forwarders
+  uint16_t rx_delay;
+  // slotted schedule only - offset between the local clock and the sink clock
+  clock_time_t time_offset;
+  // slotted schedule only - timer firing at the beginning of the node slot
+  struct ctimer slot_timer;
+  // slotted schedule only - upward packets waiting for the node slot
+  // traffic classes only - packets waiting for the completion of the previous transmission
+  struct backlog_entry backlog[TX_BACKLOG_SIZE];
+  uint8_t backlog_length;
+  // persistence only - timer used to batch the writes of the sink state
+  struct ctimer persist_timer;
 };
 
 // Callback structure
@@ -50,6 +125,11 @@ struct protocol_callbacks
   void (*recv)(const linkaddr_t *originator, uint8_t hops);
   // node received data packet callback
   void (*sr_recv)(struct protocol_conn *c, uint8_t hops);
+  // sink received bulk data callback, called every time the payload received in order grows.
+  // [data] points to the beginning of the payload, [offset] and [length] delimit the new bytes
+  void (*bulk_recv)(const linkaddr_t *originator, const uint8_t *data, uint16_t offset, uint16_t length, bool complete, uint8_t hops);
+  // sink reliable message completion callback, [acked] is false if the retries ran out
+  void (*delivered)(const linkaddr_t *dest, uint8_t id, bool acked);
 };
 
 // Initialize the protocol
@@ -63,10 +143,22 @@ void open_protocol(
 // Close the protocol and free space
 void close_protocol(struct protocol_conn *conn);
 
-// Send a packet to the sink, using the parent data of nodes
-int send_sink(struct protocol_conn *c);
+// Send a packet of traffic class [tclass] to the sink, using the parent data of nodes
+int send_sink(struct protocol_conn *c, uint8_t tclass);
+
+// Send [length] bytes to the sink split in fragments. Returns -1 if the previous bulk payload is still being sent
+int send_sink_bulk(struct protocol_conn *c, const void *data, uint16_t length);
+
+/// Send packet of traffic class [tclass] to a specific node, only if sink
+int send_node(struct protocol_conn *c, linkaddr_t *dest, uint8_t tclass);
+
+/// Send packet of traffic class [tclass] to a node of the tree of the sink, retransmitting it until acknowledged.
+/// Returns the id of the message, passed to the delivered callback, -1 if too many messages are pending, if one is already
+/// pending for [dest] or, with multiple sinks, if [dest] is attached to another sink
+int send_node_reliable(struct protocol_conn *c, linkaddr_t *dest, uint8_t tclass);
 
-/// Send packet to a specific node, only if sink
-int send_node(struct protocol_conn *c, linkaddr_t *dest);
+/// Send the same packet to a set of nodes, only if sink. The packet is duplicated only where the routes branch or the header is full.
+/// Returns the number of copies sent by the sink, -1 if none of the destinations can be reached
+int send_nodes(struct protocol_conn *c, linkaddr_t *dests, uint8_t count);
 
 #endif /* __MY_COLLECT_H__ */
@@ -0,0 +1,70 @@
+#include "contiki.h"
+#include "core/net/linkaddr.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "params.h"
+#include "mem-stats.h"
+
+// header of every reliable message, written after the RELIABLE_PACKET id in a source routed control packet.
+// The destination acknowledges it with a DATA_PACKET carrying the id as payload
+typedef struct reliable_header
+{
+    uint8_t id;
+    // beacon seqn of the sink when the message has been sent, tells apart the ids reused after a reboot of the sink
+    uint16_t seqn;
+} __attribute__((packed)) reliable_header;
+
+// sink only - message waiting for the end-to-end acknowledgement of its destination
+typedef struct reliable_tx
+{
+    linkaddr_t dest;
+    // identifies the message among the ones sent by the sink, 0 if the slot is free
+    uint8_t id;
+    // beacon seqn of the sink when the message has been sent, see reliable_header
+    uint16_t seqn;
+    uint8_t tclass;
+    // retransmissions already sent
+    uint8_t retries;
+    // length of the route used for the last transmission
+    uint8_t hops;
+    // when the last transmission has been sent
+    clock_time_t sent_at;
+    // timer used to retransmit the message
+    struct ctimer timer;
+    // owner of the slot, passed back in the timer callback
+    void *owner;
+    uint8_t length;
+    uint8_t data[RELIABLE_MAX_PAYLOAD];
+} reliable_tx;
+
+// sink only - smoothed round trip time of a single hop, in clock ticks scaled as in TCP
+typedef struct reliable_rtt
+{
+    // mean, scaled by 8. 0 until the first sample
+    int32_t srtt;
+    // mean deviation, scaled by 4
+    int32_t rttvar;
+} reliable_rtt;
+
+/// allocate a pool of [size] free slots
+reliable_tx *rel_pool_alloc(uint8_t size, void *owner);
+
+/// retrieve the slot of the message [id] sent to [dest]. Returns NULL if not found
+reliable_tx *rel_pool_get(reliable_tx *pool, uint8_t size, uint8_t id, const linkaddr_t *dest);
+
+/// retrieve the slot of the message waiting for the acknowledgement of [dest]. Returns NULL if none
+reliable_tx *rel_pool_find(reliable_tx *pool, uint8_t size, const linkaddr_t *dest);
+
+/// take a free slot. Returns NULL if every slot is waiting for an acknowledgement
+reliable_tx *rel_pool_take(reliable_tx *pool, uint8_t size);
+
+/// stop the timer of the slot and free it
+void rel_release(reliable_tx *tx);
+
+/// update the estimate with the round trip [sample] of a message routed through [hops] hops
+void rel_rtt_sample(reliable_rtt *rtt, clock_time_t sample, uint8_t hops);
+
+/// retransmission timeout of a message routed through [hops] hops, doubled at every retry
+clock_time_t rel_timeout(const reliable_rtt *rtt, uint8_t hops, uint8_t retries);
@@ -4,25 +4,46 @@
 #include <string.h>
 #include <math.h>
 #include <stdbool.h>
+#include "mem-stats.h"
+
+// the table doubles its size when full, up to UINT8_MAX entries
+#define RTABLE_ALLOW_RESIZE 0x01
+// the table replaces its least recently refreshed entry when full
+#define RTABLE_ALLOW_EVICT 0x02
+// the table keeps the depth of every entry in the tree rooted at this node, updated at every change
+#define RTABLE_TREE_INDEX 0x04
+
+// deepest valid depth, the greater values mark the entries without a valid route
+#define RTABLE_MAX_DEPTH 0xFD
+// the chain of parents reaches a node without entry
+#define RTABLE_DEPTH_UNKNOWN 0xFE
+// the entry is in a loop, or below one
+#define RTABLE_DEPTH_LOOP 0xFF
 
 // generic entry of the routing table
 typedef struct entry
 {
     linkaddr_t child;
     linkaddr_t parent;
+    // epoch of the last refresh
+    uint16_t epoch;
+    // tree index only - number of hops from the root, or one of the markers above
+    uint8_t depth;
 } routing_entry;
 
-// structure containing a list of all routing entries
+// structure containing a list of all routing entries, the first _used are valid
 typedef struct table
 {
     routing_entry *entries;
-    bool allow_resize;
+    uint8_t flags;
     uint8_t size;
     uint8_t _used;
+    // current epoch, stamped on the entries added or updated
+    uint16_t epoch;
 } routing_table;
 
-/// allocate a new routing table to size elements
-routing_table *rtable_alloc(uint8_t size, bool allow_resize);
+/// allocate a new routing table to size elements, [flags] select the behaviour when the table is full
+routing_table *rtable_alloc(uint8_t size, uint8_t flags);
 
 /// try to retrieve a specific entry, returns the index in the routing table and populate the struct [entry] if found, -1 otherwise
 int rtable_get(routing_table *table, linkaddr_t *child, routing_entry *entry);
@@ -30,8 +51,18 @@ int rtable_get(routing_table *table, linkaddr_t *child, routing_entry *entry);
 /// try to add a new entry to the table. Succeeds only if the table has space and the [entry.child] is not already present. Does not update the entry
 bool rtable_add(routing_table *table, routing_entry *entry);
 
-/// try to update a new entry in the table. Succeeds only if the [entry.child] is already present
+/// try to update a new entry in the table, refreshing it. Succeeds only if the [entry.child] is already present
 bool rtable_update(routing_table *table, routing_entry *entry);
 
+/// remove the entry of [child] in constant time after the lookup, the last entry takes its place
+bool rtable_remove(routing_table *table, linkaddr_t *child);
+
+/// set the current epoch, the entries added or updated from now on are stamped with it
+void rtable_set_epoch(routing_table *table, uint16_t epoch);
+
+/// remove the entries not refreshed for more than [max_age] epochs, calling [removed] (if not NULL) for each of them.
+/// Returns the number of entries removed
+uint8_t rtable_expire(routing_table *table, uint16_t max_age, void (*removed)(routing_entry *entry));
+
 /// free the routing table allocated space
 void rtable_free(routing_table *table);
\ No newline at end of file
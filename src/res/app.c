@@ -7,9 +7,20 @@
 #include "core/net/linkaddr.h"
 #include "protocol.h"
 #include "simple-energest.h"
+#include "sink-report.h"
+#include "mem-stats.h"
 #include "params.h"
 #ifndef CONTIKI_TARGET_SKY
-linkaddr_t sink = {{0xF7, 0x9C}}; /* Firefly (testbed): node 1 will be our sink */
+#if MULTI_SINK == 1
+linkaddr_t sinks[] = {
+    {{0xF7, 0x9C}}, /* Firefly (testbed): node 1 */
+    {{0xF3, 0xA3}}  /* Firefly (testbed): node 34 */
+};
+#define APP_SINKS 2
+#else
+linkaddr_t sinks[] = {{{0xF7, 0x9C}}}; /* Firefly (testbed): node 1 will be our sink */
+#define APP_SINKS 1
+#endif
 #define APP_NODES 10
 linkaddr_t dest_list[] = {
     {{0xF3, 0x84}}, /* Firefly node 3 */
@@ -24,7 +35,16 @@ linkaddr_t dest_list[] = {
     {{0xF3, 0xA3}}  /* Firefly node 34 */
 };
 #else
-linkaddr_t sink = {{0x01, 0x00}}; /* TMote Sky (Cooja): node 1 will be our sink */
+#if MULTI_SINK == 1
+linkaddr_t sinks[] = {
+    {{0x01, 0x00}}, /* TMote Sky (Cooja): node 1 */
+    {{0x0A, 0x00}}  /* TMote Sky (Cooja): node 10 */
+};
+#define APP_SINKS 2
+#else
+linkaddr_t sinks[] = {{{0x01, 0x00}}}; /* TMote Sky (Cooja): node 1 will be our sink */
+#define APP_SINKS 1
+#endif
 #define APP_NODES 9
 linkaddr_t dest_list[] = {
     {{0x02, 0x00}},
@@ -51,17 +71,34 @@ app_msg;
 
 static struct protocol_conn protocol_conn;
 
+static bool is_sink(const linkaddr_t *addr);
+
 static void sink_recv_cb(const linkaddr_t *originator, uint8_t hops);
 
+static void report_recv(const linkaddr_t *originator, const app_msg *msg, uint8_t hops);
+
+static void report_sr_sent(const linkaddr_t *dest, uint16_t seqn, uint8_t tclass);
+
+static uint8_t msg_class(uint16_t seqn);
+
 static void sr_recv_cb(struct protocol_conn *ptr, uint8_t hops);
 
+static void sink_bulk_recv_cb(const linkaddr_t *originator, const uint8_t *data,
+                              uint16_t offset, uint16_t length, bool complete, uint8_t hops);
+
+static void sink_delivered_cb(const linkaddr_t *dest, uint8_t id, bool acked);
+
 static struct protocol_callbacks sink_cb = {
     .recv = sink_recv_cb,
     .sr_recv = NULL,
+    .bulk_recv = sink_bulk_recv_cb,
+    .delivered = sink_delivered_cb,
 };
 static struct protocol_callbacks node_cb = {
     .recv = NULL,
     .sr_recv = sr_recv_cb,
+    .bulk_recv = NULL,
+    .delivered = NULL,
 };
 
 PROCESS_THREAD(app_process, ev, data)
@@ -70,21 +107,40 @@ PROCESS_THREAD(app_process, ev, data)
   static struct etimer rnd;
   static app_msg msg = {.seqn = 0};
   static uint8_t dest_idx = 0;
+#if APP_DOWNWARD_MULTI_DEST == 0
   static linkaddr_t dest = {{0x00, 0x00}};
+#endif
   static int ret;
+  static uint8_t tclass;
+#if APP_BULK_READINGS > 0
+  static app_msg batch[APP_BULK_READINGS];
+  static uint8_t batch_len = 0;
+#endif
 
   PROCESS_BEGIN();
 
   /* Start energest to estimate node duty cycle */
   simple_energest_start();
+#if MEM_STATS == 1
+  /* Paint the free RAM before the protocol allocates anything */
+  mem_stats_start();
+  printf("Memory: static conn %u entry %u backlog %u\n",
+         (unsigned)sizeof(struct protocol_conn), (unsigned)sizeof(routing_entry),
+         (unsigned)(TX_BACKLOG_SIZE * sizeof(struct backlog_entry)));
+#endif
 
-  if (linkaddr_cmp(&sink, &linkaddr_node_addr))
+  if (is_sink(&linkaddr_node_addr))
   {
 
     printf("App: I am sink %02x:%02x\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
     open_protocol(&protocol_conn, COLLECT_CHANNEL, true, &sink_cb, APP_NODES);
 
 #if APP_DOWNWARD_TRAFFIC == 1
+    /* The first sink generates the one-to-many traffic, the other ones deliver it to the nodes of their trees */
+    while (!linkaddr_cmp(&sinks[0], &linkaddr_node_addr))
+    {
+      PROCESS_YIELD();
+    }
     /* Wait a bit longer at the beginning to gather enough topology information */
     etimer_set(&periodic, MSG_INIT_DELAY);
     while (1)
@@ -99,16 +155,44 @@ PROCESS_THREAD(app_process, ev, data)
       memcpy(packetbuf_dataptr(), &msg, sizeof(msg));
       packetbuf_set_datalen(sizeof(msg));
 
-      /* Change the destination link address to a different node */
+#if APP_DOWNWARD_MULTI_DEST == 1
+      /* Send the same packet to all the destinations at once */
+      for (dest_idx = 0; dest_idx < APP_NODES; dest_idx++)
+      {
+        if (!is_sink(&dest_list[dest_idx]))
+        {
+          report_sr_sent(&dest_list[dest_idx], msg.seqn, TRAFFIC_NORMAL);
+        }
+      }
+      ret = send_nodes(&protocol_conn, dest_list, APP_NODES);
+      if (ret <= 0)
+      {
+        printf("App: sink could not send seqn %d\n", msg.seqn);
+      }
+      msg.seqn++;
+#else
+      /* Change the destination link address to a different node, skipping the other sinks */
+      while (is_sink(&dest_list[dest_idx]))
+      {
+        dest_idx = (dest_idx + 1) % APP_NODES;
+      }
       linkaddr_copy(&dest, &dest_list[dest_idx]);
 
       /* Send the packet downwards */
-      printf("App: sink sending seqn %d to %02x:%02x\n",
-             msg.seqn, dest.u8[0], dest.u8[1]);
-      ret = send_node(&protocol_conn, &dest);
+      tclass = msg_class(msg.seqn);
+      report_sr_sent(&dest, msg.seqn, tclass);
+#if RELIABLE_DOWNWARD == 1 && APP_DOWNWARD_RELIABLE == 1
+      ret = send_node_reliable(&protocol_conn, &dest, tclass);
+      if (ret > 0)
+      {
+        printf("App: reliable id %d seqn %d\n", ret, msg.seqn);
+      }
+#else
+      ret = send_node(&protocol_conn, &dest, tclass);
+#endif
 
-      /* Check that the packet could be sent */
-      if (ret == 0)
+      /* Check that the packet could be sent: -1 without a route, 0 if refused by the MAC */
+      if (ret <= 0)
       {
         printf("App: sink could not send seqn %d to %02x:%02x\n",
                msg.seqn, dest.u8[0], dest.u8[1]);
@@ -121,6 +205,7 @@ PROCESS_THREAD(app_process, ev, data)
       {
         dest_idx = 0;
       }
+#endif /* APP_DOWNWARD_MULTI_DEST == 1 */
     }
 #endif /* APP_DOWNWARD_TRAFFIC == 1 */
   }
@@ -138,11 +223,30 @@ PROCESS_THREAD(app_process, ev, data)
       etimer_set(&rnd, random_rand() % (MSG_PERIOD / 2));
       PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&rnd));
 
+#if APP_BULK_READINGS > 0
+      /* Batch the readings and send them all together */
+      printf("App: send seqn %d\n", msg.seqn);
+      batch[batch_len++] = msg;
+      if (batch_len >= APP_BULK_READINGS)
+      {
+        if (send_sink_bulk(&protocol_conn, batch, sizeof(batch)) < 0)
+        {
+          printf("App: could not send bulk of %d readings\n", batch_len);
+        }
+        batch_len = 0;
+      }
+#else
       packetbuf_clear();
       memcpy(packetbuf_dataptr(), &msg, sizeof(msg));
       packetbuf_set_datalen(sizeof(msg));
+      tclass = msg_class(msg.seqn);
+#if TRAFFIC_CLASSES == 1
+      printf("App: send seqn %d class %u\n", msg.seqn, tclass);
+#else
       printf("App: send seqn %d\n", msg.seqn);
-      send_sink(&protocol_conn);
+#endif
+      send_sink(&protocol_conn, tclass);
+#endif /* APP_BULK_READINGS > 0 */
       msg.seqn++;
     }
 #endif /* APP_UPWARD_TRAFFIC == 1 */
@@ -151,6 +255,61 @@ PROCESS_THREAD(app_process, ev, data)
   PROCESS_END();
 }
 
+static bool is_sink(const linkaddr_t *addr)
+{
+  uint8_t i;
+  for (i = 0; i < APP_SINKS; i++)
+  {
+    if (linkaddr_cmp(&sinks[i], addr))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Alarm-like messages, sent with the critical class */
+static uint8_t msg_class(uint16_t seqn)
+{
+#if TRAFFIC_CLASSES == 1 && APP_CRITICAL_INTERVAL > 0
+  if (seqn % APP_CRITICAL_INTERVAL == 0)
+  {
+    return TRAFFIC_CRITICAL;
+  }
+#endif
+  return TRAFFIC_NORMAL;
+}
+
+static void report_recv(const linkaddr_t *originator, const app_msg *msg, uint8_t hops)
+{
+#if SINK_BINARY_REPORT == 1
+  struct sink_report_recv report = {.source = *originator, .seqn = msg->seqn, .hops = hops};
+  sink_report(SINK_REPORT_RECV, &report, sizeof(report));
+#else
+#if LATENCY_TRACKING == 1
+  printf("App: recv from %02x:%02x seqn %u hops %u delay %u\n",
+         originator->u8[0], originator->u8[1], msg->seqn, hops, protocol_conn.rx_delay);
+#else
+  printf("App: recv from %02x:%02x seqn %u hops %u\n",
+         originator->u8[0], originator->u8[1], msg->seqn, hops);
+#endif
+#endif
+}
+
+static void report_sr_sent(const linkaddr_t *dest, uint16_t seqn, uint8_t tclass)
+{
+#if SINK_BINARY_REPORT == 1
+  struct sink_report_sr_sent report = {.dest = *dest, .seqn = seqn};
+  sink_report(SINK_REPORT_SR_SENT, &report, sizeof(report));
+#elif TRAFFIC_CLASSES == 1
+  printf("App: sink sending seqn %d to %02x:%02x class %u\n",
+         seqn, dest->u8[0], dest->u8[1], tclass);
+#else
+  printf("App: sink sending seqn %d to %02x:%02x\n",
+         seqn, dest->u8[0], dest->u8[1]);
+#endif
+}
+
 static void sink_recv_cb(const linkaddr_t *originator, uint8_t hops)
 {
   app_msg msg;
@@ -160,8 +319,29 @@ static void sink_recv_cb(const linkaddr_t *originator, uint8_t hops)
     return;
   }
   memcpy(&msg, packetbuf_dataptr(), sizeof(msg));
-  printf("App: recv from %02x:%02x seqn %u hops %u\n",
-         originator->u8[0], originator->u8[1], msg.seqn, hops);
+  report_recv(originator, &msg, hops);
+}
+
+static void sink_bulk_recv_cb(const linkaddr_t *originator, const uint8_t *data,
+                              uint16_t offset, uint16_t length, bool complete, uint8_t hops)
+{
+  app_msg msg;
+  uint16_t i;
+  /* Readings may span two fragments, wait for the whole batch */
+  if (!complete)
+  {
+    return;
+  }
+  for (i = 0; i + sizeof(msg) <= offset + length; i += sizeof(msg))
+  {
+    memcpy(&msg, data + i, sizeof(msg));
+    report_recv(originator, &msg, hops);
+  }
+}
+
+static void sink_delivered_cb(const linkaddr_t *dest, uint8_t id, bool acked)
+{
+  printf("App: reliable id %u to %02x:%02x %s\n", id, dest->u8[0], dest->u8[1], acked ? "acked" : "failed");
 }
 
 static void sr_recv_cb(struct protocol_conn *ptr, uint8_t hops)
@@ -173,6 +353,11 @@ static void sr_recv_cb(struct protocol_conn *ptr, uint8_t hops)
     return;
   }
   memcpy(&sr_msg, packetbuf_dataptr(), sizeof(app_msg));
+#if LATENCY_TRACKING == 1
+  printf("App: sr_recv from sink seqn %u hops %u node metric %u delay %u\n",
+         sr_msg.seqn, hops, ptr->hop_to_sink, ptr->rx_delay);
+#else
   printf("App: sr_recv from sink seqn %u hops %u node metric %u\n",
          sr_msg.seqn, hops, ptr->hop_to_sink);
+#endif
 }
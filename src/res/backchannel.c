@@ -0,0 +1,137 @@
+#include "src/include/backchannel.h"
+#include "dev/serial-line.h"
+
+PROCESS(backchannel_process, "Backchannel process");
+
+static const struct backchannel_callbacks *bc_callbacks = NULL;
+static void *bc_ptr = NULL;
+static linkaddr_t bc_sinks[BACKCHANNEL_MAX_SINKS];
+static uint8_t bc_sinks_count = 0;
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// parse two hex digits, returns the string after them or NULL
+static const char *parse_byte(const char *str, uint8_t *value)
+{
+    int high = hex_value(str[0]);
+    if (high < 0)
+        return NULL;
+    int low = hex_value(str[1]);
+    if (low < 0)
+        return NULL;
+    *value = (high << 4) | low;
+    return str + 2;
+}
+
+// parse an address printed as xx:xx followed by a space or the end of the line
+static const char *parse_addr(const char *str, linkaddr_t *addr)
+{
+    str = parse_byte(str, &addr->u8[0]);
+    if (str == NULL || *str++ != ':')
+        return NULL;
+    str = parse_byte(str, &addr->u8[1]);
+    if (str == NULL || (*str != ' ' && *str != '\0'))
+        return NULL;
+    return *str == ' ' ? str + 1 : str;
+}
+
+static void backchannel_input(const char *line)
+{
+    linkaddr_t child, parent, sink, dest;
+    uint8_t data[BACKCHANNEL_MAX_DATA];
+    uint16_t length = 0;
+
+    if (strncmp(line, BACKCHANNEL_PREFIX, strlen(BACKCHANNEL_PREFIX)) != 0)
+        return;
+    line += strlen(BACKCHANNEL_PREFIX);
+
+    if (strncmp(line, BACKCHANNEL_ROUTE, strlen(BACKCHANNEL_ROUTE)) == 0)
+    {
+        line = parse_addr(line + strlen(BACKCHANNEL_ROUTE), &child);
+        if (line == NULL || parse_addr(line, &parent) == NULL)
+            return;
+        bc_callbacks->route(bc_ptr, &child, &parent);
+    }
+    else if (strncmp(line, BACKCHANNEL_DATA, strlen(BACKCHANNEL_DATA)) == 0)
+    {
+        line = parse_addr(line + strlen(BACKCHANNEL_DATA), &sink);
+        if (line == NULL || (line = parse_addr(line, &dest)) == NULL)
+            return;
+        // The bridge relays the payloads to every sink, take only the ones for this sink
+        if (linkaddr_cmp(&sink, &linkaddr_node_addr) == 0)
+            return;
+        while (*line != '\0' && length < BACKCHANNEL_MAX_DATA)
+        {
+            line = parse_byte(line, &data[length++]);
+            if (line == NULL)
+                return;
+        }
+        bc_callbacks->data(bc_ptr, &dest, data, length);
+    }
+    else if (strncmp(line, BACKCHANNEL_SINK, strlen(BACKCHANNEL_SINK)) == 0)
+    {
+        if (parse_addr(line + strlen(BACKCHANNEL_SINK), &sink) == NULL)
+            return;
+        if (!backchannel_is_sink(&sink) && bc_sinks_count < BACKCHANNEL_MAX_SINKS)
+            bc_sinks[bc_sinks_count++] = sink;
+    }
+}
+
+PROCESS_THREAD(backchannel_process, ev, data)
+{
+    PROCESS_BEGIN();
+    while (1)
+    {
+        PROCESS_WAIT_EVENT_UNTIL(ev == serial_line_event_message);
+        backchannel_input((const char *)data);
+    }
+    PROCESS_END();
+}
+
+void backchannel_open(const struct backchannel_callbacks *callbacks, void *ptr)
+{
+    bc_callbacks = callbacks;
+    bc_ptr = ptr;
+    process_start(&backchannel_process, NULL);
+    // The bridge replays the announcements to the sinks that start later
+    printf(BACKCHANNEL_PREFIX BACKCHANNEL_SINK "%02x:%02x\n", linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
+}
+
+bool backchannel_is_sink(const linkaddr_t *addr)
+{
+    uint8_t i;
+    for (i = 0; i < bc_sinks_count; i++)
+    {
+        if (linkaddr_cmp(&bc_sinks[i], addr) != 0)
+            return true;
+    }
+    return false;
+}
+
+void backchannel_send_route(const linkaddr_t *child, const linkaddr_t *parent)
+{
+    printf(BACKCHANNEL_PREFIX BACKCHANNEL_ROUTE "%02x:%02x %02x:%02x\n",
+           child->u8[0], child->u8[1], parent->u8[0], parent->u8[1]);
+}
+
+bool backchannel_send_data(const linkaddr_t *sink, const linkaddr_t *dest, const uint8_t *data, uint16_t length)
+{
+    if (length > BACKCHANNEL_MAX_DATA)
+        return false;
+    uint16_t i = 0;
+    printf(BACKCHANNEL_PREFIX BACKCHANNEL_DATA "%02x:%02x %02x:%02x ",
+           sink->u8[0], sink->u8[1], dest->u8[0], dest->u8[1]);
+    for (i = 0; i < length; i++)
+        printf("%02x", data[i]);
+    printf("\n");
+    return true;
+}
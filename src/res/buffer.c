@@ -41,8 +41,7 @@ void *buffer_read(buffer *buf, size_t size)
 {
     if (buf->mode != BUF_READ)
         return NULL;
-    void *ptr = NULL;
-    memcpy(ptr, buf->pointer + buf->offset, size);
+    void *ptr = buf->pointer + buf->offset;
     buf->offset += size;
     buf->size += size;
     return ptr;
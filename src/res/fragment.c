@@ -0,0 +1,84 @@
+#include "src/include/fragment.h"
+
+uint8_t frag_count(uint16_t length)
+{
+    return (length + FRAGMENT_PAYLOAD_SIZE - 1) / FRAGMENT_PAYLOAD_SIZE;
+}
+
+reassembly_buffer *frag_pool_alloc(uint8_t size, void *owner)
+{
+    reassembly_buffer *pool = malloc(sizeof(reassembly_buffer) * size);
+    if (pool == NULL)
+        return NULL;
+    uint8_t i = 0;
+    for (i = 0; i < size; i++)
+    {
+        pool[i].count = 0;
+        pool[i].delivered = 0;
+        pool[i].owner = owner;
+    }
+    return pool;
+}
+
+reassembly_buffer *frag_pool_get(reassembly_buffer *pool, uint8_t size, const linkaddr_t *source, uint8_t tag, uint8_t count)
+{
+    reassembly_buffer *free_buf = NULL;
+    uint8_t i = 0;
+    for (i = 0; i < size; i++)
+    {
+        if (pool[i].count != 0 && pool[i].tag == tag && linkaddr_cmp(source, &pool[i].source) != 0)
+            return &pool[i];
+        // Completed payloads are kept to recognize duplicates, but can be reused. Prefer the empty buffers
+        if (pool[i].count == 0 && (free_buf == NULL || free_buf->count != 0))
+            free_buf = &pool[i];
+        else if (pool[i].delivered == pool[i].count && free_buf == NULL)
+            free_buf = &pool[i];
+    }
+    if (count == 0 || free_buf == NULL)
+        return NULL;
+    free_buf->source = *source;
+    free_buf->tag = tag;
+    free_buf->count = count;
+    free_buf->received = 0;
+    free_buf->delivered = 0;
+    free_buf->retries = 0;
+    free_buf->last_length = 0;
+    return free_buf;
+}
+
+bool frag_store(reassembly_buffer *buf, uint8_t index, const void *data, uint8_t length)
+{
+    if (index >= buf->count || length > FRAGMENT_PAYLOAD_SIZE)
+        return false;
+    // Only the last fragment can be shorter
+    if (index < buf->count - 1 && length != FRAGMENT_PAYLOAD_SIZE)
+        return false;
+    if ((uint16_t)index * FRAGMENT_PAYLOAD_SIZE + length > FRAGMENT_MAX_SIZE)
+        return false;
+    memcpy(buf->data + (uint16_t)index * FRAGMENT_PAYLOAD_SIZE, data, length);
+    buf->received |= (uint32_t)1 << index;
+    if (index == buf->count - 1)
+        buf->last_length = length;
+    return true;
+}
+
+uint32_t frag_missing(reassembly_buffer *buf)
+{
+    uint32_t all = buf->count >= 32 ? UINT32_MAX : ((uint32_t)1 << buf->count) - 1;
+    return all & ~buf->received;
+}
+
+uint16_t frag_contiguous_length(reassembly_buffer *buf, uint8_t fragments)
+{
+    if (fragments == 0)
+        return 0;
+    if (fragments >= buf->count)
+        return (uint16_t)(buf->count - 1) * FRAGMENT_PAYLOAD_SIZE + buf->last_length;
+    return (uint16_t)fragments * FRAGMENT_PAYLOAD_SIZE;
+}
+
+void frag_release(reassembly_buffer *buf)
+{
+    ctimer_stop(&buf->timer);
+    buf->count = 0;
+}
@@ -1,15 +1,19 @@
 #include "src/include/packet.h"
 
-void _write_packet_header(uint8_t packet_id, void *data_ptr, size_t size)
+int _write_packet_header(uint8_t packet_id, void *data_ptr, size_t size)
 {
     size_t res = packetbuf_hdralloc(sizeof(uint8_t) + size);
     if (res == 0)
-        return;
+    {
+        printf("Packet error: no header room for packet %u, %u bytes\n", packet_id, (unsigned int)(sizeof(uint8_t) + size));
+        return 0;
+    }
     memcpy(packetbuf_hdrptr(), &packet_id, sizeof(uint8_t));
     if (size > 0)
     {
         memcpy(packetbuf_hdrptr() + sizeof(uint8_t), data_ptr, size);
     }
+    return 1;
 }
 
 void _read_packet_id(uint8_t *id)
@@ -0,0 +1,37 @@
+#include "src/include/persist.h"
+#include "cfs/cfs.h"
+#include "lib/crc16.h"
+
+bool persist_save(const char *name, const void *data, uint16_t length)
+{
+    persist_header hdr = {.magic = PERSIST_MAGIC, .version = PERSIST_VERSION, .length = length};
+    hdr.checksum = crc16_data((const unsigned char *)data, length, 0);
+
+    // Remove the old record, otherwise a shorter one would leave stale bytes in the file
+    cfs_remove(name);
+    int fd = cfs_open(name, CFS_WRITE);
+    if (fd < 0)
+        return false;
+    bool res = cfs_write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+               cfs_write(fd, data, length) == length;
+    cfs_close(fd);
+    return res;
+}
+
+int persist_load(const char *name, void *data, uint16_t max_length)
+{
+    persist_header hdr;
+    int fd = cfs_open(name, CFS_READ);
+    if (fd < 0)
+        return -1;
+    int res = -1;
+    if (cfs_read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+        hdr.magic == PERSIST_MAGIC && hdr.version == PERSIST_VERSION && hdr.length <= max_length &&
+        cfs_read(fd, data, hdr.length) == hdr.length &&
+        crc16_data((const unsigned char *)data, hdr.length, 0) == hdr.checksum)
+    {
+        res = hdr.length;
+    }
+    cfs_close(fd);
+    return res;
+}
@@ -7,19 +7,174 @@
 #include <stdio.h>
 #include "core/net/linkaddr.h"
 #include "protocol.h"
+#include "simple-energest.h"
 
 #define LOG_ENABLED 0
 
+// the source could not be stored by a node along the path, the sink must use source routing to reach it
+#define PIGGYBACK_FLAG_NOT_STORED 0x01
+// the payload starts with a fragment_header
+#define PIGGYBACK_FLAG_FRAGMENT 0x02
+// the payload starts with the path record: the number of forwarders followed by their addresses, the last forwarder first
+#define PIGGYBACK_FLAG_PATH_RECORD 0x04
+// the payload is the id of the reliable message acknowledged by the source
+#define PIGGYBACK_FLAG_ACK 0x08
+
+struct piggyback_header
+{
+	linkaddr_t source;
+	linkaddr_t parent;
+	uint8_t hops;
+	uint8_t flags;
+#if LATENCY_TRACKING == 1
+	// ms spent queued in the forwarders
+	uint16_t delay;
+#endif
+} __attribute__((packed));
+
+struct storing_header
+{
+	linkaddr_t dest;
+	uint8_t hops;
+} __attribute__((packed));
+
+// the node is one of the destinations of a multi destination packet
+#define MULTI_ROUTE_DEST 0x80
+#define MULTI_ROUTE_CHILDREN_MASK 0x7F
+
+// node of the sub-tree encoded in pre-order in a multi destination header
+struct multi_route_entry
+{
+	linkaddr_t addr;
+	// MULTI_ROUTE_DEST flag and number of children
+	uint8_t info;
+} __attribute__((packed));
+// entries of a multi destination header, bounded by the header room left after the packet id and the hop count
+#define MULTI_ROUTE_FIT ((MULTI_ROUTE_HDR_ROOM - 2 * sizeof(uint8_t)) / sizeof(struct multi_route_entry))
+#define MULTI_ROUTE_ENTRIES (MULTI_ROUTE_MAX_NODES < MULTI_ROUTE_FIT ? MULTI_ROUTE_MAX_NODES : MULTI_ROUTE_FIT)
+
+// sink request for the missing fragments of a payload
+struct fragment_nack
+{
+	uint8_t tag;
+	uint32_t missing;
+} __attribute__((packed));
+
+// size of the source routing header before the route
+#if LATENCY_TRACKING == 1
+#define SOURCE_ROUTE_HEADER_SIZE (sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint16_t))
+#else
+#define SOURCE_ROUTE_HEADER_SIZE (sizeof(uint8_t) + sizeof(uint8_t))
+#endif
+
+struct beacon_msg;
+
 // Unicast recv callback
 void _unicast_recv(struct unicast_conn *c, const linkaddr_t *from);
+// Unicast sent callback, the MAC completed the transmission of the last packet
+void _unicast_sent(struct unicast_conn *c, int status, int num_tx);
 // Broadcast recv callback
 void _broadcast_recv(struct broadcast_conn *conn, const linkaddr_t *sender);
 // Callback when the beacon timer expires, only on sink
 void _beacon_timer_cb(void *ptr);
 // callback when the topology dedicated update expires
 void _topology_timer_cb(void *ptr);
-// Handle packets based on the id
-void _handle_packet(uint8_t packet_id, struct protocol_conn *conn);
+// Schedule a topology update, piggybacked if a packet is sent to the sink before the timer expires
+void _mark_topology_dirty(struct protocol_conn *conn);
+// Start a new beacon epoch in the routing tables, removing the stale routes
+void _new_epoch(struct protocol_conn *conn);
+// Called for every route removed from the sink routing table
+void _route_expired(routing_entry *entry);
+// Send the packet in the packetbuf to the sink, setting [flags] in the piggyback header
+int _send_sink(struct protocol_conn *conn, uint8_t flags, uint8_t tclass);
+// Source route the packet in the packetbuf towards [dest] with the given packet id, only if sink
+int _send_source_route(struct protocol_conn *c, linkaddr_t *dest, uint8_t packet_id, uint8_t tclass);
+// Node only - deliver a reliable message and acknowledge it to the sink
+void _reliable_recv(struct protocol_conn *conn, uint8_t hops);
+// Sink only - handle the acknowledgement of a reliable message sent by [source]
+void _reliable_ack(struct protocol_conn *conn, const linkaddr_t *source);
+// Sink only - (re)transmit a reliable message and arm its retransmission timer
+void _reliable_send(struct protocol_conn *conn, reliable_tx *tx);
+// Callback when a reliable message has not been acknowledged in time
+void _reliable_timer_cb(void *ptr);
+// Sink only - handle a fragment of a bulk payload
+void _fragment_recv(struct protocol_conn *conn, const linkaddr_t *source, uint8_t hops);
+// Callback when the sink has been waiting for missing fragments for too long
+void _reassembly_timer_cb(void *ptr);
+// Callback sending the next pending fragment
+void _fragment_timer_cb(void *ptr);
+// Send the upward packet in the packetbuf to the parent, in the node slot if the schedule is slotted
+int _send_upward(struct protocol_conn *conn, uint8_t tclass);
+// Send the packet in the packetbuf to [next_hop], queued in the backlog while the MAC is busy if the traffic has classes
+int _send_unicast(struct protocol_conn *conn, const linkaddr_t *next_hop, uint8_t tclass);
+// Mark the traffic class in the packet id of the header just written, and set its MAC transmissions
+void _set_class(uint8_t tclass);
+// Queue the packet in the packetbuf in the backlog, dropping the least urgent packet if full. Returns 0 if dropped
+int _backlog_push(struct protocol_conn *conn, const linkaddr_t *next_hop, uint8_t tclass);
+// Slotted schedule only - send the packet in the packetbuf right away, the backlog has no room for it
+int _backlog_overflow(struct protocol_conn *conn, const linkaddr_t *next_hop, uint8_t tclass);
+// Index of the next backlog entry to send, the most urgent unless an older one has been overtaken too often
+uint8_t _backlog_next(struct protocol_conn *conn);
+// Send the backlog entry at [index] and remove it
+int _backlog_send(struct protocol_conn *conn, uint8_t index);
+// Clock shared with the sink through the beacons
+clock_time_t _network_time(struct protocol_conn *conn);
+// Callback at the beginning of the node slot, sends the backlog
+void _slot_timer_cb(void *ptr);
+// Restore the routing state saved in flash before the last reboot
+void _restore_state(struct protocol_conn *conn);
+// Node only - save the current parent in flash
+void _persist_node(struct protocol_conn *conn);
+// Sink only - save the beacon seqn and the routing table in flash after PERSIST_DELAY
+void _schedule_persist(struct protocol_conn *conn);
+// Callback saving the sink state
+void _persist_timer_cb(void *ptr);
+// Time in ms elapsed since [since], saturated
+uint16_t _elapsed_ms(clock_time_t since);
+// Load of the node advertised in the beacons
+uint8_t _node_load(struct protocol_conn *conn);
+// Cost of choosing a parent, the lower the better
+int32_t _parent_cost(uint16_t hop_to_sink, int16_t rssi, uint8_t load);
+// Whether the sender of [beacon] is a better parent than the current one
+bool _better_parent(struct protocol_conn *conn, struct beacon_msg *beacon, int16_t rssi);
+// Local repair only - whether [beacon] comes from the current parent and advertises a different rank or tree,
+// after a local repair above the node
+bool _parent_moved(struct protocol_conn *conn, struct beacon_msg *beacon, const linkaddr_t *sender);
+// Fill [beacon] with the current topology state of the node
+void _fill_beacon(struct protocol_conn *conn, struct beacon_msg *beacon);
+// Node only - take the sender of [beacon] as parent if the beacon is new or the sender better.
+// [repair] if the beacon is a reply to a local repair request
+void _accept_beacon(struct protocol_conn *conn, struct beacon_msg *beacon, const linkaddr_t *sender, int16_t rssi, bool repair);
+// Local repair only - account for a unicast to the parent, detaching from it after REPAIR_TX_FAILURES failures
+void _check_parent(struct protocol_conn *conn, bool acked);
+// Callback broadcasting the repair requests of a detached node
+void _repair_timer_cb(void *ptr);
+// Handle the repair request in the packetbuf, scheduling a reply if the node has a shorter path
+void _repair_request_recv(struct protocol_conn *conn, const linkaddr_t *sender, int16_t rssi);
+// Callback replying to the pending repair request with a unicast beacon
+void _repair_reply_cb(void *ptr);
+// Handle packets based on the id, [from] is the neighbor the packet has been received from
+void _handle_packet(uint8_t packet_id, struct protocol_conn *conn, const linkaddr_t *from);
+// Sink only - add or update the parent of [child] in the routing table, sharing it with the other sinks
+void _refresh_route(struct protocol_conn *conn, linkaddr_t *child, linkaddr_t *parent);
+// Sink only - add, update or refresh the parent of [child] in the routing table.
+// Returns whether the route changed or has been refreshed for the first time in the epoch
+bool _update_route(struct protocol_conn *conn, linkaddr_t *child, linkaddr_t *parent);
+// Sink only - send the packet in the packetbuf to [dest] in the tree of this sink
+int _send_node(struct protocol_conn *c, linkaddr_t *dest, uint8_t tclass);
+// Find the sink at the root of the route towards [dest]. Returns false if the route is not known or does not end at a sink known to the backchannel
+bool _route_root(routing_table *routing_table, linkaddr_t *dest, linkaddr_t *root);
+// Backchannel callback, another sink shared a route
+void _backchannel_route(void *ptr, const linkaddr_t *child, const linkaddr_t *parent);
+// Backchannel callback, another sink handed over a packet for a node of this tree
+void _backchannel_data(void *ptr, const linkaddr_t *dest, const uint8_t *data, uint16_t length);
+// Path recording only - add the node to the path record at the beginning of the packetbuf
+void _record_path(struct protocol_conn *conn);
+// Sink only - refresh the routes of the forwarders in the path record and remove it from the packetbuf.
+// Returns false if the record is malformed
+bool _learn_path(struct protocol_conn *conn, uint8_t hops);
+// Storing mode only - learn the next hop towards the source of an upward packet
+void _store_descendant(struct protocol_conn *conn, struct piggyback_header *hdr, const linkaddr_t *from);
 // Build the route towards the specified destination from the sink.
 // Returns the length of the route and populates in [path] an array of hops.
 // The path returned includes the first hop to do from the sink, I.E:
@@ -27,6 +182,13 @@ void _handle_packet(uint8_t packet_id, struct protocol_conn *conn);
 // Therefore when copying the path to the header, can skip the first entry.
 // Remember to free the [path] populated
 uint8_t _build_route(routing_table *routing_table, linkaddr_t *dest, linkaddr_t **path);
+// Returns the length in bytes of the pre-order encoded sub-tree starting at [subtree], 0 if it exceeds [available]
+uint16_t _multi_route_length(const uint8_t *subtree, uint16_t available);
+// Send [payload] to the root of the encoded [subtree], the header carries the whole sub-tree
+int _send_multi_route(struct protocol_conn *conn, uint8_t hops, const uint8_t *subtree, uint16_t length, const void *payload, uint16_t payload_length);
+// Encode the sub-tree of every neighbor of the sink in the tree of [nodes] nodes rooted at the sink, send a copy of [payload]
+// to each of them. Returns the number of copies sent
+int _send_multi_route_tree(struct protocol_conn *conn, const linkaddr_t *addrs, const uint8_t *parents, const bool *is_dest, uint8_t nodes, const void *payload, uint16_t payload_length);
 
 // Rime Callback structures
 struct broadcast_callbacks bc_cb = {
@@ -34,7 +196,10 @@ struct broadcast_callbacks bc_cb = {
 	.sent = NULL};
 struct unicast_callbacks uc_cb = {
 	.recv = _unicast_recv,
-	.sent = NULL};
+	.sent = _unicast_sent};
+struct backchannel_callbacks backchannel_cb = {
+	.route = _backchannel_route,
+	.data = _backchannel_data};
 
 void open_protocol(struct protocol_conn *conn, uint16_t channels,
 				   bool is_sink, const struct protocol_callbacks *callbacks, uint16_t nodes)
@@ -42,12 +207,39 @@ void open_protocol(struct protocol_conn *conn, uint16_t channels,
 	linkaddr_copy(&conn->parent, &linkaddr_null);
 	conn->hop_to_sink = is_sink ? 0 : UINT16_MAX;
 	conn->parent_rssi = INT16_MIN;
+	conn->parent_load = 0;
+	conn->forwarded = 0;
 	conn->beacon_seqn = 0;
+	conn->refresh_seqn = 0;
+	conn->sink = is_sink ? linkaddr_node_addr : linkaddr_null;
+	conn->sink_time = 0;
 	conn->is_sink = is_sink;
 	conn->callbacks = callbacks;
 	conn->nodes = nodes;
 	conn->topology_dirty = false;
 	conn->topology_refreshed = false;
+	conn->path_record_count = 0;
+	conn->storing_table = NULL;
+	conn->reassembly = NULL;
+	conn->reliable = NULL;
+	conn->reliable_rtt.srtt = 0;
+	conn->reliable_rtt.rttvar = 0;
+	conn->reliable_id = 0;
+	conn->reliable_seqn = 0;
+	conn->fragment_tx.data = NULL;
+	conn->fragment_tx.pending = 0;
+	// The sink keeps the completed payloads to drop the duplicates, a tag restarting at the same value after a reboot
+	// would match the first payload
+	conn->fragment_tx.tag = random_rand();
+	conn->time_offset = 0;
+	conn->rx_time = 0;
+	conn->rx_class = TRAFFIC_NORMAL;
+	conn->tx_busy = false;
+	conn->rx_delay = 0;
+	conn->backlog_length = 0;
+	conn->parent_failures = 0;
+	conn->repair_requests = 0;
+	conn->repair_requester = linkaddr_null;
 
 	// Open the underlying Rime primitives
 	broadcast_open(&conn->bc, channels, &bc_cb);
@@ -55,16 +247,51 @@ void open_protocol(struct protocol_conn *conn, uint16_t channels,
 	if (is_sink)
 	{
 		// Allocate a new routing table structure
-		conn->routing_table = rtable_alloc(nodes, true);
+		conn->routing_table = rtable_alloc(nodes, RTABLE_ALLOW_RESIZE | RTABLE_ALLOW_EVICT | RTABLE_TREE_INDEX);
 		conn->beacon_seqn = 1;
 		// Send first beacon after some time
 		ctimer_set(&conn->beacon_timer, INIT_BEACON_DELAY, _beacon_timer_cb, conn);
+#if MULTI_SINK == 1
+		backchannel_open(&backchannel_cb, conn);
+#endif
 	}
+#if DOWNWARD_STORING_MODE == 1
+	// The sink must be able to reach every node, the others only keep a bounded table
+	conn->storing_table = rtable_alloc(is_sink ? nodes : STORING_TABLE_SIZE, is_sink ? RTABLE_ALLOW_RESIZE : 0);
+#endif
+#if RELIABLE_DOWNWARD == 1
+	if (is_sink)
+		conn->reliable = rel_pool_alloc(RELIABLE_MAX_PENDING, conn);
+#endif
+#if FRAGMENTATION_ENABLED == 1
+	if (is_sink)
+		conn->reassembly = frag_pool_alloc(FRAGMENT_BUFFERS, conn);
+	else
+		conn->fragment_tx.data = malloc(FRAGMENT_MAX_SIZE);
+#endif
+#if PERSIST_STATE == 1
+	_restore_state(conn);
+#endif
+	_new_epoch(conn);
 }
 
 void close_protocol(struct protocol_conn *conn)
 {
-	rtable_free(conn->routing_table);
+	if (conn->is_sink)
+		rtable_free(conn->routing_table);
+	if (conn->storing_table != NULL)
+		rtable_free(conn->storing_table);
+	if (conn->reassembly != NULL)
+		free(conn->reassembly);
+	if (conn->fragment_tx.data != NULL)
+		free(conn->fragment_tx.data);
+	if (conn->reliable != NULL)
+	{
+		uint8_t i;
+		for (i = 0; i < RELIABLE_MAX_PENDING; i++)
+			ctimer_stop(&conn->reliable[i].timer);
+		free(conn->reliable);
+	}
 }
 
 #pragma region TopologyBeacon
@@ -72,17 +299,93 @@ struct beacon_msg
 {
 	uint16_t seqn;
 	uint16_t hop_to_sink;
+#if PARENT_LOAD_AWARE == 1
+	uint8_t load;
+#endif
+#if SLOTTED_SCHEDULE == 1
+	// sink clock when the beacon has been sent
+	uint32_t time;
+#endif
+#if MULTI_SINK == 1
+	// root of the tree
+	linkaddr_t sink;
+#endif
 } __attribute__((packed));
 
+uint8_t _node_load(struct protocol_conn *conn)
+{
+	// The sink is the destination of the traffic anyway
+	if (conn->is_sink)
+		return 0;
+	uint32_t load = (uint32_t)LOAD_RADIO_WEIGHT * simple_energest_radio_permille() + (uint32_t)LOAD_FORWARD_WEIGHT * conn->forwarded;
+	return load > UINT8_MAX ? UINT8_MAX : load;
+}
+
+int32_t _parent_cost(uint16_t hop_to_sink, int16_t rssi, uint8_t load)
+{
+	return (int32_t)PARENT_HOP_WEIGHT * hop_to_sink - (int32_t)PARENT_RSSI_WEIGHT * rssi + (int32_t)PARENT_LOAD_WEIGHT * load;
+}
+
+bool _better_parent(struct protocol_conn *conn, struct beacon_msg *beacon, int16_t rssi)
+{
+#if PARENT_LOAD_AWARE == 1
+	// Within an epoch the descendants of the node are farther from the sink than the node, only closer senders are loop free
+	if (beacon->hop_to_sink >= conn->hop_to_sink)
+		return false;
+	// Switch only if the sender is cheaper than the current parent
+	return _parent_cost(beacon->hop_to_sink + 1, rssi, beacon->load) < _parent_cost(conn->hop_to_sink, conn->parent_rssi, conn->parent_load);
+#else
+	// Worse hop_to_sink than what we have, or not a stronger link
+	if (beacon->hop_to_sink + 1 > conn->hop_to_sink)
+		return false;
+	return rssi > conn->parent_rssi;
+#endif
+}
+
+bool _parent_moved(struct protocol_conn *conn, struct beacon_msg *beacon, const linkaddr_t *sender)
+{
+#if LOCAL_REPAIR == 1
+	if (linkaddr_cmp(sender, &conn->parent) == 0)
+		return false;
+	// No path is longer than the number of nodes, stop following a parent that goes round a loop
+	if (beacon->hop_to_sink >= conn->nodes)
+		return false;
+#if MULTI_SINK == 1
+	if (linkaddr_cmp(&beacon->sink, &conn->sink) == 0)
+		return true;
+#endif
+	return beacon->seqn == conn->beacon_seqn && beacon->hop_to_sink + 1 != conn->hop_to_sink;
+#else
+	return false;
+#endif
+}
+
+void _fill_beacon(struct protocol_conn *conn, struct beacon_msg *beacon)
+{
+	beacon->seqn = conn->beacon_seqn;
+	beacon->hop_to_sink = conn->hop_to_sink;
+#if PARENT_LOAD_AWARE == 1
+	beacon->load = _node_load(conn);
+#endif
+#if SLOTTED_SCHEDULE == 1
+	beacon->time = _network_time(conn);
+#endif
+#if MULTI_SINK == 1
+	beacon->sink = conn->sink;
+#endif
+}
+
 void _send_beacon(struct protocol_conn *conn)
 {
-	struct beacon_msg beacon = {
-		.seqn = conn->beacon_seqn, .hop_to_sink = conn->hop_to_sink};
+	struct beacon_msg beacon;
+	_fill_beacon(conn, &beacon);
+	// A new beacon period starts
+	conn->forwarded = 0;
 
 	// Send the beacon message in broadcast
 	packetbuf_clear();
-	packetbuf_copyfrom(&beacon, sizeof(beacon));
-	broadcast_send(&conn->bc);
+	if (_write_packet_header(BEACON_PACKET, &beacon, sizeof(beacon)))
+		broadcast_send(&conn->bc);
 }
 
 void _topology_timer_cb(void *ptr)
@@ -93,12 +396,52 @@ void _topology_timer_cb(void *ptr)
 		// Send dedicated topology update
 		printf("Protocol: dedicated topology update\n");
 		packetbuf_clear();
-		send_sink(conn);
+		send_sink(conn, TRAFFIC_NORMAL);
 		conn->topology_dirty = false;
 		conn->topology_refreshed = false;
 	}
 }
 
+void _mark_topology_dirty(struct protocol_conn *conn)
+{
+	conn->topology_dirty = true;
+	// A new update is needed even if the previous one has been piggybacked
+	conn->topology_refreshed = false;
+	ctimer_set(&conn->topology_timer, TOPOLOGY_UPDATE_DELAY + FORWARD_DELAY, _topology_timer_cb, conn);
+}
+
+void _new_epoch(struct protocol_conn *conn)
+{
+	if (conn->is_sink)
+	{
+		rtable_set_epoch(conn->routing_table, conn->beacon_seqn);
+#if ROUTE_EXPIRY_EPOCHS > 0
+		if (rtable_expire(conn->routing_table, ROUTE_EXPIRY_EPOCHS, _route_expired) > 0)
+		{
+#if PERSIST_STATE == 1
+			_schedule_persist(conn);
+#endif
+		}
+#endif
+	}
+	if (conn->storing_table != NULL)
+	{
+		rtable_set_epoch(conn->storing_table, conn->beacon_seqn);
+#if ROUTE_EXPIRY_EPOCHS > 0
+		rtable_expire(conn->storing_table, ROUTE_EXPIRY_EPOCHS, NULL);
+#endif
+	}
+}
+
+void _route_expired(routing_entry *entry)
+{
+#if TOPOLOGY_EVENTS_LOG == 1
+	printf("Topology: route %02x:%02x removed\n", entry->child.u8[0], entry->child.u8[1]);
+#endif
+	if (LOG_ENABLED)
+		printf("Protocol: routing expired: (%02x:%02x > %02x:%02x)\n", entry->child.u8[0], entry->child.u8[1], entry->parent.u8[0], entry->parent.u8[1]);
+}
+
 void _beacon_timer_cb(void *ptr)
 {
 	struct protocol_conn *conn = (struct protocol_conn *)ptr;
@@ -106,82 +449,271 @@ void _beacon_timer_cb(void *ptr)
 	if (conn->is_sink)
 	{
 		conn->beacon_seqn += 1;
+		_new_epoch(conn);
 		ctimer_set(&conn->beacon_timer, BEACON_PERIOD, _beacon_timer_cb, conn);
+#if PERSIST_STATE == 1
+		if (conn->beacon_seqn % PERSIST_SEQN_INTERVAL == 0)
+			_schedule_persist(conn);
+#endif
 	}
 }
 
 void _broadcast_recv(struct broadcast_conn *bc_conn, const linkaddr_t *sender)
 {
 	struct beacon_msg beacon;
+	uint8_t packet_id = 0;
 
 	/* Get the pointer to the overall structure protocol_conn from its field bc */
 	struct protocol_conn *conn = (struct protocol_conn *)(((uint8_t *)bc_conn) -
 														  offsetof(struct protocol_conn, bc));
-	// No need for the sink to listen for broadcast messages
+	int16_t rssi = packetbuf_attr(PACKETBUF_ATTR_RSSI);
+	_read_packet_id(&packet_id);
+#if LOCAL_REPAIR == 1
+	// The sink replies to the repair requests too
+	if (packet_id == REPAIR_REQUEST_PACKET)
+	{
+		_repair_request_recv(conn, sender, rssi);
+		return;
+	}
+#endif
+	// No need for the sink to listen for beacons
 	if (conn->is_sink)
 		return;
 
 	/* Check if the received broadcast packet looks legitimate */
-	if (packetbuf_datalen() != sizeof(struct beacon_msg))
+	if (packet_id != BEACON_PACKET || packetbuf_datalen() != sizeof(struct beacon_msg))
 	{
 		if (LOG_ENABLED)
-			printf("Protocol error: broadcast message of wrong size\n");
+			printf("Protocol error: broadcast message of wrong type or size\n");
 		return;
 	}
 	memcpy(&beacon, packetbuf_dataptr(), sizeof(struct beacon_msg));
 
-	int16_t rssi = packetbuf_attr(PACKETBUF_ATTR_RSSI);
-
+#if LINK_TRACE_LOG == 1
+	printf("Trace: beacon from %02x:%02x rssi %d\n", sender->u8[0], sender->u8[1], rssi);
+#endif
 	if (LOG_ENABLED)
 		printf("Protocol: beacon metrics from %02x:%02x seqn %u hop_to_sink %u rssi %d\n",
 			   sender->u8[0], sender->u8[1],
 			   beacon.seqn, beacon.hop_to_sink + 1, rssi);
-	if (rssi < RSSI_THRESHOLD || beacon.seqn < conn->beacon_seqn)
-		return; // The beacon is either too weak or too old, ignore it
-	if (beacon.seqn == conn->beacon_seqn)
-	{ // The beacon is not new, check the hop_to_sink
-		if (beacon.hop_to_sink + 1 > conn->hop_to_sink)
-			return; // Worse or equal than what we have, ignore it
-		if (rssi <= conn->parent_rssi)
+	_accept_beacon(conn, &beacon, sender, rssi, false);
+}
+
+void _accept_beacon(struct protocol_conn *conn, struct beacon_msg *beacon, const linkaddr_t *sender, int16_t rssi, bool repair)
+{
+	if (rssi < RSSI_THRESHOLD)
+		return; // The beacon is too weak, ignore it
+	// The subtree follows the rank of the parent, so that the rank rule still holds after a repair within the epoch
+	bool parent_moved = _parent_moved(conn, beacon, sender);
+#if MULTI_SINK == 1
+	bool other_sink = linkaddr_cmp(&beacon->sink, &conn->sink) == 0 && linkaddr_cmp(&conn->sink, &linkaddr_null) == 0;
+	// The seqn of another sink is unrelated, join its tree only if cheaper or if the current sink went silent
+	if (other_sink && !parent_moved && (clock_time_t)(clock_time() - conn->sink_time) < SINK_TIMEOUT && !_better_parent(conn, beacon, rssi))
+		return;
+	if (!other_sink)
+#endif
+	{
+		if (beacon->seqn < conn->beacon_seqn)
+			return; // The beacon is too old, ignore it
+#if LOCAL_REPAIR == 1
+		// While detached, a beacon of the same epoch may come from the subtree of the node, only the replies follow the rank rule
+		if (!repair && conn->repair_requests > 0 && beacon->seqn == conn->beacon_seqn)
+			return;
+#endif
+		// The beacon is not new, accept it only if the sender is better than the current parent
+		if (beacon->seqn == conn->beacon_seqn && !parent_moved && !_better_parent(conn, beacon, rssi))
 			return;
 	}
+	if (LOG_ENABLED && parent_moved)
+		printf("Protocol: parent %02x:%02x moved to hop_to_sink %u\n", sender->u8[0], sender->u8[1], beacon->hop_to_sink + 1);
 	if (LOG_ENABLED)
 		printf("Protocol: accept beacon from %02x:%02x seqn %u hop_to_sink %u rssi %d\n",
 			   sender->u8[0], sender->u8[1],
-			   beacon.seqn, beacon.hop_to_sink + 1, rssi);
+			   beacon->seqn, beacon->hop_to_sink + 1, rssi);
 	linkaddr_t old_parent = conn->parent;
+	bool new_epoch = beacon->seqn != conn->beacon_seqn;
 	/* Otherwise, memorize the new parent, the hop_to_sink, and the seqn */
 	linkaddr_copy(&conn->parent, sender);
-	conn->hop_to_sink = beacon.hop_to_sink + 1;
+	conn->hop_to_sink = beacon->hop_to_sink + 1;
 	conn->parent_rssi = rssi;
-	conn->beacon_seqn = beacon.seqn;
+	conn->beacon_seqn = beacon->seqn;
+#if PARENT_LOAD_AWARE == 1
+	conn->parent_load = beacon->load;
+#endif
+#if MULTI_SINK == 1
+	if (LOG_ENABLED && linkaddr_cmp(&conn->sink, &beacon->sink) == 0)
+		printf("Protocol: joining the tree of sink %02x:%02x\n", beacon->sink.u8[0], beacon->sink.u8[1]);
+	conn->sink = beacon->sink;
+	conn->sink_time = clock_time();
+#endif
+#if SLOTTED_SCHEDULE == 1
+	// Align to the sink clock, the delay of the hops above is already included by the sender
+	conn->time_offset = (clock_time_t)beacon->time + SLOT_HOP_CORRECTION - clock_time();
+#endif
+#if LOCAL_REPAIR == 1
+	if (conn->repair_requests > 0)
+	{
+		if (repair)
+			printf("Protocol: local repair via %02x:%02x\n", sender->u8[0], sender->u8[1]);
+		// Attached again, stop the requests
+		conn->repair_requests = 0;
+		ctimer_stop(&conn->repair_timer);
+	}
+#endif
 
+	// After a repair within the epoch the beacon is not flooded again, it only reaches the neighbors. The children
+	// follow the new rank and forward it only if theirs changed, so the update stops at the end of the subtree
 	ctimer_set(&conn->beacon_timer, FORWARD_DELAY, _beacon_timer_cb, conn);
 
 	// If the new parent is different from the old, send a dedicated topology update, send the update rigth away, before sending the beacon
 	if (linkaddr_cmp(&old_parent, sender) == 0)
 	{
+#if TOPOLOGY_EVENTS_LOG == 1
+		printf("Topology: parent %02x:%02x hops %u\n", sender->u8[0], sender->u8[1], conn->hop_to_sink);
+#endif
 		if (LOG_ENABLED)
 		{
 			printf("Protocol: new parent %02x:%02x, hop_to_sink %d, seqn %d\n", sender->u8[0], sender->u8[1], conn->hop_to_sink, conn->beacon_seqn);
 			printf("Protocol topology: setting topology to dirty\n");
 		}
-		conn->topology_dirty = true;
-		ctimer_set(&conn->topology_timer, TOPOLOGY_UPDATE_DELAY + FORWARD_DELAY, _topology_timer_cb, conn);
+		_mark_topology_dirty(conn);
+#if LOCAL_REPAIR == 1
+		conn->parent_failures = 0;
+		// The subtree of the node has been unreachable, update the sink as soon as the other replies settled
+		if (repair)
+			ctimer_set(&conn->topology_timer, REPAIR_REPLY_SPREAD, _topology_timer_cb, conn);
+#endif
+#if PERSIST_STATE == 1
+		_persist_node(conn);
+#endif
+	}
+#if ROUTE_EXPIRY_EPOCHS > 0
+	// Nothing has been sent to the sink for a while, refresh the route before it expires
+	else if (new_epoch && (uint16_t)(conn->beacon_seqn - conn->refresh_seqn) >= ROUTE_EXPIRY_EPOCHS / 2 && !conn->topology_dirty)
+	{
+		_mark_topology_dirty(conn);
 	}
+#endif
+	if (new_epoch)
+		_new_epoch(conn);
 }
 #pragma endregion TopologyBeacon
 
+#pragma region LocalRepair
+struct repair_request
+{
+	// epoch and hop_to_sink of the node before losing its parent, only neighbors closer to the sink reply
+	uint16_t seqn;
+	uint16_t hop_to_sink;
+#if MULTI_SINK == 1
+	linkaddr_t sink;
+#endif
+} __attribute__((packed));
+
+void _check_parent(struct protocol_conn *conn, bool acked)
+{
+	if (acked)
+	{
+		conn->parent_failures = 0;
+		return;
+	}
+	if (++conn->parent_failures < REPAIR_TX_FAILURES)
+		return;
+	if (LOG_ENABLED)
+		printf("Protocol: parent %02x:%02x lost after %u failures\n", conn->parent.u8[0], conn->parent.u8[1], conn->parent_failures);
+	// Detach from the tree, the hop_to_sink is kept for the rank rule of the requests.
+	// The children keep their parent, the subtree reattaches with the node
+	linkaddr_copy(&conn->parent, &linkaddr_null);
+	conn->parent_rssi = INT16_MIN;
+	conn->parent_load = 0;
+	conn->parent_failures = 0;
+	conn->repair_requests = 0;
+	// Any pending reply to a neighbor is no longer valid
+	ctimer_set(&conn->repair_timer, 0, _repair_timer_cb, conn);
+}
+
+void _repair_timer_cb(void *ptr)
+{
+	struct protocol_conn *conn = (struct protocol_conn *)ptr;
+	// Out of requests, the node reattaches with the next beacon
+	if (conn->repair_requests >= REPAIR_MAX_REQUESTS)
+	{
+		if (LOG_ENABLED)
+			printf("Protocol: local repair failed, waiting for the next beacon\n");
+		return;
+	}
+	struct repair_request request = {.seqn = conn->beacon_seqn, .hop_to_sink = conn->hop_to_sink};
+#if MULTI_SINK == 1
+	request.sink = conn->sink;
+#endif
+	conn->repair_requests++;
+	printf("Protocol: local repair request\n");
+	packetbuf_clear();
+	if (_write_packet_header(REPAIR_REQUEST_PACKET, &request, sizeof(request)))
+		broadcast_send(&conn->bc);
+	ctimer_set(&conn->repair_timer, REPAIR_TIMEOUT, _repair_timer_cb, conn);
+}
+
+void _repair_request_recv(struct protocol_conn *conn, const linkaddr_t *sender, int16_t rssi)
+{
+	struct repair_request request;
+	if (packetbuf_datalen() != sizeof(struct repair_request))
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: repair request of wrong size\n");
+		return;
+	}
+	memcpy(&request, packetbuf_dataptr(), sizeof(request));
+	// A detached node has no path to offer, a child of the requester would create a loop
+	if (!conn->is_sink && (linkaddr_cmp(&conn->parent, &linkaddr_null) != 0 || linkaddr_cmp(&conn->parent, sender) != 0))
+		return;
+	// The requester would ignore the reply
+	if (rssi < RSSI_THRESHOLD)
+		return;
+	// The sink has already moved to the seqn of its next beacon
+	uint16_t seqn = conn->is_sink ? conn->beacon_seqn - 1 : conn->beacon_seqn;
+#if MULTI_SINK == 1
+	// The subtree of the requester is in the tree of its sink, any node of another tree is loop free
+	if (linkaddr_cmp(&request.sink, &conn->sink) != 0)
+#endif
+	{
+		// Rank rule: in the same epoch the subtree of the requester is farther from the sink than the requester
+		if (seqn < request.seqn || (seqn == request.seqn && conn->hop_to_sink >= request.hop_to_sink))
+			return;
+	}
+	// A single reply pending at a time, to the first requester
+	if (!ctimer_expired(&conn->repair_timer))
+		return;
+	conn->repair_requester = *sender;
+	// Spread the replies of the neighbors
+	ctimer_set(&conn->repair_timer, random_rand() % REPAIR_REPLY_SPREAD, _repair_reply_cb, conn);
+}
+
+void _repair_reply_cb(void *ptr)
+{
+	struct protocol_conn *conn = (struct protocol_conn *)ptr;
+	struct beacon_msg beacon;
+	// Detached in the meantime
+	if (!conn->is_sink && linkaddr_cmp(&conn->parent, &linkaddr_null) != 0)
+		return;
+	_fill_beacon(conn, &beacon);
+	if (conn->is_sink)
+		beacon.seqn = conn->beacon_seqn - 1;
+	printf("Protocol: local repair reply to %02x:%02x\n", conn->repair_requester.u8[0], conn->repair_requester.u8[1]);
+	packetbuf_clear();
+	if (_write_packet_header(REPAIR_REPLY_PACKET, &beacon, sizeof(beacon)))
+		_send_unicast(conn, &conn->repair_requester, TRAFFIC_CRITICAL);
+}
+#pragma endregion LocalRepair
+
 #pragma region Data
 
-struct piggyback_header
+int send_sink(struct protocol_conn *conn, uint8_t tclass)
 {
-	linkaddr_t source;
-	linkaddr_t parent;
-	uint8_t hops;
-} __attribute__((packed));
+	return _send_sink(conn, 0, tclass);
+}
 
-int send_sink(struct protocol_conn *conn)
+int _send_sink(struct protocol_conn *conn, uint8_t flags, uint8_t tclass)
 {
 	if (linkaddr_cmp(&conn->parent, &linkaddr_null) != 0)
 	{
@@ -190,7 +722,11 @@ int send_sink(struct protocol_conn *conn)
 		return -1;
 	}
 
-	struct piggyback_header hdr = {.source = linkaddr_node_addr, .parent = conn->parent, .hops = 0};
+	struct piggyback_header hdr = {.source = linkaddr_node_addr, .parent = conn->parent, .hops = 0, .flags = flags};
+	conn->refresh_seqn = conn->beacon_seqn;
+#if LATENCY_TRACKING == 1
+	hdr.delay = 0;
+#endif
 	// Piggyback topology information
 	if (conn->topology_dirty && !conn->topology_refreshed)
 	{
@@ -199,10 +735,24 @@ int send_sink(struct protocol_conn *conn)
 		conn->topology_refreshed = true;
 		conn->topology_dirty = false;
 	}
-	_write_packet_header(DATA_PACKET, &hdr, sizeof(hdr));
+#if PATH_RECORDING == 1
+	// Sample the packets recording their path, the forwarders add themselves in front of the record
+	if (++conn->path_record_count >= PATH_RECORD_SAMPLING)
+	{
+		uint8_t count = 0;
+		conn->path_record_count = 0;
+		if (packetbuf_hdralloc(sizeof(count)))
+		{
+			memcpy(packetbuf_hdrptr(), &count, sizeof(count));
+			hdr.flags |= PIGGYBACK_FLAG_PATH_RECORD;
+		}
+	}
+#endif
+	if (!_write_packet_header(DATA_PACKET, &hdr, sizeof(hdr)))
+		return 0;
 	if (LOG_ENABLED)
 		printf("Protocol: send to sink, first hop %02x:%02x\n", conn->parent.u8[0], conn->parent.u8[1]);
-	return unicast_send(&conn->uc, &conn->parent);
+	return _send_upward(conn, tclass);
 }
 
 void _unicast_recv(struct unicast_conn *uc_conn, const linkaddr_t *from)
@@ -212,11 +762,78 @@ void _unicast_recv(struct unicast_conn *uc_conn, const linkaddr_t *from)
 														  offsetof(struct protocol_conn, uc));
 
 	uint8_t packet_id;
+	conn->rx_time = clock_time();
 	_read_packet_id(&packet_id);
-	_handle_packet(packet_id, conn);
+#if TRAFFIC_CLASSES == 1
+	// Forwarders keep the class of the packet
+	conn->rx_class = packet_id >> PACKET_CLASS_SHIFT;
+#endif
+	_handle_packet(packet_id & PACKET_ID_MASK, conn, from);
+}
+
+void _unicast_sent(struct unicast_conn *uc_conn, int status, int num_tx)
+{
+#if LOCAL_REPAIR == 1 || (TRAFFIC_CLASSES == 1 && SLOTTED_SCHEDULE == 0)
+	struct protocol_conn *conn = (struct protocol_conn *)(((uint8_t *)uc_conn) -
+														  offsetof(struct protocol_conn, uc));
+#endif
+#if LOCAL_REPAIR == 1
+	// Only the unicasts to the parent tell whether it is still reachable
+	if (!conn->is_sink && linkaddr_cmp(packetbuf_addr(PACKETBUF_ADDR_RECEIVER), &conn->parent) != 0)
+		_check_parent(conn, status == MAC_TX_OK);
+#endif
+#if TRAFFIC_CLASSES == 1 && SLOTTED_SCHEDULE == 0
+	conn->tx_busy = false;
+	// Hand the next packet to the MAC
+	if (conn->backlog_length > 0)
+		_backlog_send(conn, _backlog_next(conn));
+#endif
+}
+
+uint16_t _elapsed_ms(clock_time_t since)
+{
+	// clock_time_t is 16 bits on the Sky, take the difference before widening so that it survives the wrap
+	uint32_t ms = (uint32_t)(clock_time_t)(clock_time() - since) * 1000 / CLOCK_SECOND;
+	return ms > UINT16_MAX ? UINT16_MAX : ms;
+}
+
+int send_node(struct protocol_conn *c, linkaddr_t *dest, uint8_t tclass)
+{
+	if (!c->is_sink)
+		return -1;
+
+#if MULTI_SINK == 1
+	linkaddr_t root;
+	// The destination is attached to another sink, hand the packet over through the backchannel
+	if (_route_root(c->routing_table, dest, &root) && linkaddr_cmp(&root, &linkaddr_node_addr) == 0)
+	{
+		if (LOG_ENABLED)
+			printf("Protocol: %02x:%02x attached to sink %02x:%02x\n", dest->u8[0], dest->u8[1], root.u8[0], root.u8[1]);
+		return backchannel_send_data(&root, dest, packetbuf_dataptr(), packetbuf_datalen()) ? 1 : -1;
+	}
+#endif
+	return _send_node(c, dest, tclass);
+}
+
+int _send_node(struct protocol_conn *c, linkaddr_t *dest, uint8_t tclass)
+{
+#if DOWNWARD_STORING_MODE == 1
+	routing_entry next;
+	// Every node along the path knows the next hop, use the fixed size header. Otherwise fall back to source routing
+	if (rtable_get(c->storing_table, dest, &next) >= 0 && linkaddr_cmp(&next.parent, &linkaddr_null) == 0)
+	{
+		struct storing_header hdr = {.dest = *dest, .hops = 0};
+		if (!_write_packet_header(STORING_ROUTE_PACKET, &hdr, sizeof(hdr)))
+			return 0;
+		if (LOG_ENABLED)
+			printf("Protocol: sink toward %02x:%02x stored, first hop %02x:%02x\n", dest->u8[0], dest->u8[1], next.parent.u8[0], next.parent.u8[1]);
+		return _send_unicast(c, &next.parent, tclass);
+	}
+#endif
+	return _send_source_route(c, dest, SOURCE_ROUTE_PACKET, tclass);
 }
 
-int send_node(struct protocol_conn *c, linkaddr_t *dest)
+int _send_source_route(struct protocol_conn *c, linkaddr_t *dest, uint8_t packet_id, uint8_t tclass)
 {
 	if (!c->is_sink)
 		return -1;
@@ -227,7 +844,7 @@ int send_node(struct protocol_conn *c, linkaddr_t *dest)
 	{
 		size_t j = 0;
 		printf("Protocol: rtable ");
-		for (j = 0; j < c->routing_table->size; j++)
+		for (j = 0; j < c->routing_table->_used; j++)
 		{
 			routing_entry entry = c->routing_table->entries[j];
 			printf("(%02x:%02x)-(%02x:%02x) |", entry.child.u8[0], entry.child.u8[1], entry.parent.u8[0], entry.parent.u8[1]);
@@ -251,10 +868,14 @@ int send_node(struct protocol_conn *c, linkaddr_t *dest)
 	length = length - 1;
 
 	// Write the length and the hops in the header
-	buffer *w_buf = buffer_allocate_write(sizeof(uint8_t) + sizeof(uint8_t) + (sizeof(linkaddr_t) * length));
+	buffer *w_buf = buffer_allocate_write(SOURCE_ROUTE_HEADER_SIZE + (sizeof(linkaddr_t) * length));
 	buffer_write(w_buf, &length, sizeof(uint8_t));
 	uint8_t hops = 0;
 	buffer_write(w_buf, &hops, sizeof(uint8_t));
+#if LATENCY_TRACKING == 1
+	uint16_t delay = 0;
+	buffer_write(w_buf, &delay, sizeof(uint16_t));
+#endif
 
 	if (LOG_ENABLED)
 		printf("Protocol: sink toward %02x:%02x, route_length %d > ", dest->u8[0], dest->u8[1], length);
@@ -271,124 +892,450 @@ int send_node(struct protocol_conn *c, linkaddr_t *dest)
 		printf("\n");
 
 	// Write the header
-	_write_packet_header(SOURCE_ROUTE_PACKET, w_buf->pointer, w_buf->size);
-	int res = unicast_send(&c->uc, &first_hop);
+	int res = _write_packet_header(packet_id, w_buf->pointer, w_buf->size);
+	if (res != 0)
+		res = _send_unicast(c, &first_hop, tclass);
 	// Free resources
 	buffer_free(w_buf);
 	free(init_path);
 	return res;
 }
 
+bool _route_root(routing_table *routing_table, linkaddr_t *dest, linkaddr_t *root)
+{
+	routing_entry entry;
+	uint8_t i;
+	*root = *dest;
+	for (i = 0; i < routing_table->size; i++)
+	{
+		// The sinks are the only nodes without a parent, any other node at the top is a gap in the chain
+		if (rtable_get(routing_table, root, &entry) < 0)
+			return i > 0 && backchannel_is_sink(root);
+		*root = entry.parent;
+	}
+	// Loop detected
+	return false;
+}
+
 uint8_t _build_route(routing_table *routing_table, linkaddr_t *dest, linkaddr_t **path)
 {
 	routing_entry entry;
-	linkaddr_t current = *dest;
-	// Initialize a list of the maximum route size and set the first element as the destination
-	linkaddr_t lookup_list[routing_table->size];
-	lookup_list[0] = *dest;
+	*path = NULL;
+	// Entry not found in the table, return a NULL path (drop the packet)
+	if (rtable_get(routing_table, dest, &entry) < 0)
+		return 0;
+	// The tree index flags loops and broken chains when the routes are updated
+	if (entry.depth > RTABLE_MAX_DEPTH)
+	{
+		if (LOG_ENABLED && entry.depth == RTABLE_DEPTH_LOOP)
+			printf("Protocol: error loop detected\n");
+		return 0;
+	}
 
-	uint8_t path_length = 1;
-	do
+	// The depth is the route length, fill the path backwards from the destination
+	uint8_t path_length = entry.depth;
+	*path = malloc(path_length * sizeof(linkaddr_t));
+	if (*path == NULL)
+		return 0;
+	uint8_t i = path_length;
+	(*path)[--i] = entry.child;
+	while (i > 0)
 	{
-		int res = rtable_get(routing_table, &current, &entry);
-		// Entry not found in the table, return a NULL path (drop the packet)
-		if (res < 0)
+		// Safety check, the index guarantees the chain
+		if (rtable_get(routing_table, &entry.parent, &entry) < 0)
 		{
+			free(*path);
 			*path = NULL;
 			return 0;
 		}
+		(*path)[--i] = entry.child;
+	}
+	return path_length;
+}
 
-		current = entry.parent;
-		// If we reached the sink, break the loop
-		if (linkaddr_cmp(&current, &linkaddr_node_addr) != 0)
-			break;
+uint16_t _multi_route_length(const uint8_t *subtree, uint16_t available)
+{
+	struct multi_route_entry entry;
+	uint16_t length = 0;
+	// Number of entries still to be read, each entry brings its children
+	int16_t pending = 1;
+	while (pending > 0)
+	{
+		if (length + sizeof(entry) > available)
+			return 0;
+		memcpy(&entry, subtree + length, sizeof(entry));
+		length += sizeof(entry);
+		pending += (entry.info & MULTI_ROUTE_CHILDREN_MASK) - 1;
+	}
+	return length;
+}
+
+int _send_multi_route(struct protocol_conn *conn, uint8_t hops, const uint8_t *subtree, uint16_t length, const void *payload, uint16_t payload_length)
+{
+	struct multi_route_entry root;
+	memcpy(&root, subtree, sizeof(root));
+
+	packetbuf_clear();
+	packetbuf_copyfrom(payload, payload_length);
+	buffer *w_buf = buffer_allocate_write(sizeof(uint8_t) + length);
+	buffer_write(w_buf, &hops, sizeof(uint8_t));
+	buffer_write(w_buf, (void *)subtree, length);
+	int res = _write_packet_header(MULTI_ROUTE_PACKET, w_buf->pointer, w_buf->size);
+	buffer_free(w_buf);
+	if (res == 0)
+		return 0;
+	if (LOG_ENABLED)
+		printf("Protocol: multi route towards %02x:%02x, sub-tree length %d\n", root.addr.u8[0], root.addr.u8[1], length);
+	return _send_unicast(conn, &root.addr, hops == 0 ? TRAFFIC_NORMAL : conn->rx_class);
+}
 
-		lookup_list[path_length++] = current;
-	} while (path_length < routing_table->size);
+void _refresh_route(struct protocol_conn *conn, linkaddr_t *child, linkaddr_t *parent)
+{
+#if MULTI_SINK == 1
+	if (_update_route(conn, child, parent))
+		backchannel_send_route(child, parent);
+#else
+	_update_route(conn, child, parent);
+#endif
+}
 
-	// Loop detected, return a NULL path (drop the packet)
-	if (path_length >= routing_table->size)
+bool _update_route(struct protocol_conn *conn, linkaddr_t *child, linkaddr_t *parent)
+{
+	routing_entry entry = {.child = *child, .parent = *parent};
+	// Get the current routing information of the child
+	int index = rtable_get(conn->routing_table, child, &entry);
+	if (LOG_ENABLED)
+		printf("Protocol: routing get: (%02x:%02x > %02x:%02x) present %d\n", entry.child.u8[0], entry.child.u8[1], entry.parent.u8[0], entry.parent.u8[1], index);
+	if (index < 0)
 	{
+		// No routing info found, add new one
+		rtable_add(conn->routing_table, &entry);
+#if TOPOLOGY_EVENTS_LOG == 1
+		printf("Topology: route %02x:%02x > %02x:%02x\n", child->u8[0], child->u8[1], parent->u8[0], parent->u8[1]);
+#endif
+#if PERSIST_STATE == 1
+		_schedule_persist(conn);
+#endif
 		if (LOG_ENABLED)
-			printf("Protocol: error loop detected\n");
-		*path = NULL;
-		return 0;
+			printf("Protocol: routing add: (%02x:%02x > %02x:%02x)\n", entry.child.u8[0], entry.child.u8[1], entry.parent.u8[0], entry.parent.u8[1]);
+		return true;
+	}
+	else if (linkaddr_cmp(&entry.parent, parent) == 0)
+	{
+		// Parent is changed, update the routing table
+		entry.parent = *parent;
+		rtable_update(conn->routing_table, &entry);
+#if TOPOLOGY_EVENTS_LOG == 1
+		printf("Topology: route %02x:%02x > %02x:%02x\n", child->u8[0], child->u8[1], parent->u8[0], parent->u8[1]);
+#endif
+#if PERSIST_STATE == 1
+		_schedule_persist(conn);
+#endif
+		if (LOG_ENABLED)
+			printf("Protocol: routing update: (%02x:%02x > %02x:%02x)\n", entry.child.u8[0], entry.child.u8[1], entry.parent.u8[0], entry.parent.u8[1]);
+		return true;
 	}
+	// Same route, refresh it. Share it again the first time in the epoch, so that it does not expire at the other sinks
+	bool first_refresh = entry.epoch != conn->routing_table->epoch;
+	rtable_update(conn->routing_table, &entry);
+	return first_refresh;
+}
 
-	// Build the actual path as the reversed of the lookup list
-	*path = malloc(path_length * sizeof(linkaddr_t));
-	uint8_t i = 0;
-	for (i = 0; i < path_length; i++)
+void _backchannel_route(void *ptr, const linkaddr_t *child, const linkaddr_t *parent)
+{
+	struct protocol_conn *conn = (struct protocol_conn *)ptr;
+	linkaddr_t shared_child = *child;
+	linkaddr_t shared_parent = *parent;
+	// The route comes from another sink, do not share it back
+	_update_route(conn, &shared_child, &shared_parent);
+}
+
+void _backchannel_data(void *ptr, const linkaddr_t *dest, const uint8_t *data, uint16_t length)
+{
+	struct protocol_conn *conn = (struct protocol_conn *)ptr;
+	linkaddr_t local_dest = *dest;
+	packetbuf_clear();
+	packetbuf_copyfrom(data, length);
+	if (_send_node(conn, &local_dest, TRAFFIC_NORMAL) < 0 && LOG_ENABLED)
+		printf("Protocol error: no route for %02x:%02x handed over by another sink\n", dest->u8[0], dest->u8[1]);
+}
+
+void _record_path(struct protocol_conn *conn)
+{
+	uint8_t count;
+	if (packetbuf_datalen() < sizeof(count))
+		return;
+	memcpy(&count, packetbuf_dataptr(), sizeof(count));
+	// Record full, the sink learns the rest of the path from the topology updates
+	if (count >= PATH_RECORD_MAX_DEPTH)
+		return;
+	// The previous forwarders stay in the data, only the count is moved to the header
+	if (!packetbuf_hdralloc(sizeof(count) + sizeof(linkaddr_t)))
+		return;
+	count++;
+	memcpy(packetbuf_hdrptr(), &count, sizeof(count));
+	memcpy(packetbuf_hdrptr() + sizeof(count), &linkaddr_node_addr, sizeof(linkaddr_t));
+	packetbuf_hdrreduce(sizeof(count));
+
+	// The next hop records itself as well (or is the sink), so the sink learns the current parent of the node
+	if ((count < PATH_RECORD_MAX_DEPTH || conn->hop_to_sink == 1) && conn->topology_dirty && !conn->topology_refreshed)
 	{
-		current = lookup_list[path_length - i - 1];
-		// Safety check
-		if (linkaddr_cmp(&current, &linkaddr_null) != 0)
-			continue;
+		printf("Protocol: path record topology update\n");
+		conn->topology_refreshed = true;
+		conn->topology_dirty = false;
+	}
+}
 
-		(*path)[i] = current;
+bool _learn_path(struct protocol_conn *conn, uint8_t hops)
+{
+	uint8_t count;
+	if (packetbuf_datalen() < sizeof(count))
+		return false;
+	memcpy(&count, packetbuf_dataptr(), sizeof(count));
+	if (packetbuf_datalen() < sizeof(count) + count * sizeof(linkaddr_t))
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: short path record %d\n", packetbuf_datalen());
+		return false;
 	}
-	return path_length;
+	linkaddr_t *path = (linkaddr_t *)((uint8_t *)packetbuf_dataptr() + sizeof(count));
+	uint8_t i;
+	// Every forwarder is the parent of the one that recorded itself before it
+	for (i = 0; i + 1 < count; i++)
+		_refresh_route(conn, &path[i + 1], &path[i]);
+	// If no forwarder has been skipped the last one is a child of the sink
+	if (count > 0 && count == hops - 1)
+		_refresh_route(conn, &path[0], &linkaddr_node_addr);
+	if (LOG_ENABLED)
+		printf("Protocol: path record of %d forwarders, %d hops\n", count, hops);
+	packetbuf_hdrreduce(sizeof(count) + count * sizeof(linkaddr_t));
+	return true;
 }
 
-void _handle_packet(uint8_t packet_id, struct protocol_conn *conn)
+void _store_descendant(struct protocol_conn *conn, struct piggyback_header *hdr, const linkaddr_t *from)
 {
-	switch (packet_id)
+	routing_entry entry = {.child = hdr->source, .parent = *from};
+	// A node below could not store the source, the sink will source route towards it so there is no point in storing it
+	if ((hdr->flags & PIGGYBACK_FLAG_NOT_STORED) != 0)
 	{
-	case DATA_PACKET:
+		if (!conn->is_sink)
+			return;
+		// Mark the destination as not reachable in storing mode
+		entry.parent = linkaddr_null;
+	}
+	if (rtable_update(conn->storing_table, &entry))
+		return;
+	if (!rtable_add(conn->storing_table, &entry))
 	{
-		if (packetbuf_datalen() < sizeof(struct piggyback_header))
+		// Table full, let the sink know that it has to use source routing
+		hdr->flags |= PIGGYBACK_FLAG_NOT_STORED;
+		if (LOG_ENABLED)
+			printf("Protocol: storing table full, %02x:%02x not stored\n", hdr->source.u8[0], hdr->source.u8[1]);
+	}
+}
+
+int send_nodes(struct protocol_conn *c, linkaddr_t *dests, uint8_t count)
+{
+	if (!c->is_sink)
+		return -1;
+
+	// Save the application payload, the packetbuf is rebuilt for every copy
+	static uint8_t payload[PACKETBUF_SIZE];
+	uint16_t payload_length = packetbuf_datalen();
+	memcpy(payload, packetbuf_dataptr(), payload_length);
+
+	// Sub-tree spanning the routes, node 0 is the sink itself
+	linkaddr_t addrs[MULTI_ROUTE_MAX_NODES + 1];
+	uint8_t parents[MULTI_ROUTE_MAX_NODES + 1];
+	bool is_dest[MULTI_ROUTE_MAX_NODES + 1];
+	uint8_t nodes = 1;
+	int sent = -1;
+	addrs[0] = linkaddr_node_addr;
+	is_dest[0] = false;
+
+	uint8_t d, i, j;
+	for (d = 0; d < count; d++)
+	{
+		linkaddr_t *path = NULL;
+		uint8_t length = _build_route(c->routing_table, &dests[d], &path);
+#if MULTI_SINK == 1
+		linkaddr_t root;
+		// The destination is attached to another sink, hand over a copy through the backchannel
+		if (path == NULL && _route_root(c->routing_table, &dests[d], &root) && linkaddr_cmp(&root, &linkaddr_node_addr) == 0)
 		{
-			if (LOG_ENABLED)
-				printf("Protocol error: short data packet header %d\n", packetbuf_datalen());
-			return;
+			if (backchannel_send_data(&root, &dests[d], payload, payload_length))
+				sent = sent < 0 ? 1 : sent + 1;
+			continue;
 		}
-		struct piggyback_header hdr;
-		memcpy(&hdr, packetbuf_dataptr(), sizeof(hdr));
-		hdr.hops++;
-		packetbuf_hdrreduce(sizeof(hdr));
-		if (conn->is_sink)
+#endif
+		if (path == NULL || length <= 0)
 		{
-			routing_entry entry = {.child = hdr.source, .parent = hdr.parent};
-			// Get the current routing information of the child
-			int index = rtable_get(conn->routing_table, &hdr.source, &entry);
 			if (LOG_ENABLED)
-				printf("Protocol: routing get: (%02x:%02x > %02x:%02x) present %d\n", entry.child.u8[0], entry.child.u8[1], entry.parent.u8[0], entry.parent.u8[1], index);
-			if (index < 0)
-			{
-				// No routing info found, add new one
-				rtable_add(conn->routing_table, &entry);
-				if (LOG_ENABLED)
-					printf("Protocol: routing add: (%02x:%02x > %02x:%02x)\n", entry.child.u8[0], entry.child.u8[1], entry.parent.u8[0], entry.parent.u8[1]);
+				printf("Protocol error: no routing information for %02x:%02x\n", dests[d].u8[0], dests[d].u8[1]);
+			continue;
+		}
+		if (length > MULTI_ROUTE_ENTRIES)
+		{
+			printf("Protocol error: route to %02x:%02x longer than the multi route header, %u hops\n", dests[d].u8[0], dests[d].u8[1], length);
+			free(path);
+			continue;
+		}
+		// Follow the path in the sub-tree, branching where it diverges
+		uint8_t current = 0;
+		uint8_t missing = 0;
+		for (i = 0; i < length; i++)
+		{
+			uint8_t next = 0;
+			for (j = 1; j < nodes; j++)
+			{
+				if (parents[j] == current && linkaddr_cmp(&addrs[j], &path[i]) != 0)
+				{
+					next = j;
+					break;
+				}
 			}
-			else if (linkaddr_cmp(&entry.parent, &hdr.parent) == 0)
+			if (next == 0)
 			{
-				// Parent is changed, update the routing table
-				entry.parent = hdr.parent;
-				rtable_update(conn->routing_table, &entry);
-				if (LOG_ENABLED)
-					printf("Protocol: routing update: (%02x:%02x > %02x:%02x)\n", entry.child.u8[0], entry.child.u8[1], entry.parent.u8[0], entry.parent.u8[1]);
+				// The remaining part of the path is new
+				missing = length - i;
+				break;
+			}
+			current = next;
+		}
+		if (nodes + missing > MULTI_ROUTE_ENTRIES + 1)
+		{
+			// The header is full, send the destinations collected so far and start a new sub-tree
+			int copies = _send_multi_route_tree(c, addrs, parents, is_dest, nodes, payload, payload_length);
+			if (copies > 0)
+				sent = sent < 0 ? copies : sent + copies;
+			nodes = 1;
+			current = 0;
+			missing = length;
+		}
+		for (i = length - missing; i < length; i++)
+		{
+			addrs[nodes] = path[i];
+			parents[nodes] = current;
+			is_dest[nodes] = false;
+			current = nodes++;
+		}
+		is_dest[current] = true;
+		free(path);
+	}
+	if (nodes > 1)
+	{
+		int copies = _send_multi_route_tree(c, addrs, parents, is_dest, nodes, payload, payload_length);
+		if (copies > 0)
+			sent = sent < 0 ? copies : sent + copies;
+	}
+	return sent;
+}
+
+int _send_multi_route_tree(struct protocol_conn *conn, const linkaddr_t *addrs, const uint8_t *parents, const bool *is_dest, uint8_t nodes, const void *payload, uint16_t payload_length)
+{
+	// Encode in pre-order the sub-tree of every neighbor of the sink and send a single copy to each of them
+	uint8_t subtree[MULTI_ROUTE_MAX_NODES * sizeof(struct multi_route_entry)];
+	uint8_t stack[MULTI_ROUTE_MAX_NODES];
+	uint8_t i, j;
+	int sent = 0;
+	for (i = 1; i < nodes; i++)
+	{
+		if (parents[i] != 0)
+			continue;
+		uint16_t length = 0;
+		uint8_t top = 0;
+		stack[top++] = i;
+		while (top > 0)
+		{
+			uint8_t n = stack[--top];
+			struct multi_route_entry entry = {.addr = addrs[n], .info = is_dest[n] ? MULTI_ROUTE_DEST : 0};
+			// Push the children in reverse order so that they are encoded in order
+			for (j = nodes - 1; j > n; j--)
+			{
+				if (parents[j] == n)
+				{
+					stack[top++] = j;
+					entry.info++;
+				}
 			}
+			memcpy(subtree + length, &entry, sizeof(entry));
+			length += sizeof(entry);
+		}
+		if (_send_multi_route(conn, 0, subtree, length, payload, payload_length) != 0)
+			sent++;
+	}
+	return sent;
+}
+
+void _handle_packet(uint8_t packet_id, struct protocol_conn *conn, const linkaddr_t *from)
+{
+	switch (packet_id)
+	{
+	case DATA_PACKET:
+	{
+		if (packetbuf_datalen() < sizeof(struct piggyback_header))
+		{
+			if (LOG_ENABLED)
+				printf("Protocol error: short data packet header %d\n", packetbuf_datalen());
+			return;
+		}
+		struct piggyback_header hdr;
+		memcpy(&hdr, packetbuf_dataptr(), sizeof(hdr));
+		hdr.hops++;
+		packetbuf_hdrreduce(sizeof(hdr));
+		if (conn->storing_table != NULL)
+			_store_descendant(conn, &hdr, from);
+		if (conn->is_sink)
+		{
+			_refresh_route(conn, &hdr.source, &hdr.parent);
+			if ((hdr.flags & PIGGYBACK_FLAG_PATH_RECORD) != 0 && !_learn_path(conn, hdr.hops))
+				return;
+#if LATENCY_TRACKING == 1
+			conn->rx_delay = hdr.delay;
+#endif
 			// Deliver the message to the app if was a message and not simple a topology dedicated update
-			if (packetbuf_datalen() > 0)
+			if ((hdr.flags & PIGGYBACK_FLAG_ACK) != 0)
+			{
+				_reliable_ack(conn, &hdr.source);
+			}
+			else if ((hdr.flags & PIGGYBACK_FLAG_FRAGMENT) != 0)
+			{
+				_fragment_recv(conn, &hdr.source, hdr.hops);
+			}
+			else if (packetbuf_datalen() > 0)
 			{
 				conn->callbacks->recv(&hdr.source, hdr.hops);
 			}
 		}
 		else
 		{
+			if (linkaddr_cmp(&conn->parent, &linkaddr_null) != 0)
+			{
+				if (LOG_ENABLED)
+					printf("Protocol error: no parent to forward the packet to\n");
+				return;
+			}
 			if (LOG_ENABLED)
 				printf("Protocol: forwarding packet towards %02x:%02x\n", conn->parent.u8[0], conn->parent.u8[1]);
 
-			_write_packet_header(packet_id, &hdr, sizeof(hdr));
-			unicast_send(&conn->uc, &conn->parent);
+#if LATENCY_TRACKING == 1
+			hdr.delay += _elapsed_ms(conn->rx_time);
+#endif
+			if ((hdr.flags & PIGGYBACK_FLAG_PATH_RECORD) != 0)
+				_record_path(conn);
+			if (!_write_packet_header(packet_id, &hdr, sizeof(hdr)))
+				return;
+			conn->forwarded++;
+			_send_upward(conn, conn->rx_class);
 		}
 
 		break;
 	}
 
 	case SOURCE_ROUTE_PACKET:
+	case SOURCE_ROUTE_CONTROL_PACKET:
 	{
-		if (packetbuf_datalen() < sizeof(uint8_t) + sizeof(uint8_t))
+		if (packetbuf_datalen() < SOURCE_ROUTE_HEADER_SIZE)
 		{
 			if (LOG_ENABLED)
 				printf("Protocol error: short source packet header %d\n", packetbuf_datalen());
@@ -398,6 +1345,10 @@ void _handle_packet(uint8_t packet_id, struct protocol_conn *conn)
 		buffer *r_buf = buffer_allocate_read(packetbuf_dataptr());
 		uint8_t length = *((uint8_t *)buffer_read(r_buf, sizeof(uint8_t)));
 		uint8_t hops = *((uint8_t *)buffer_read(r_buf, sizeof(uint8_t)));
+#if LATENCY_TRACKING == 1
+		uint16_t delay;
+		memcpy(&delay, buffer_read(r_buf, sizeof(uint16_t)), sizeof(uint16_t));
+#endif
 
 		// Check whether the header has the correct data (routing info)
 		if (packetbuf_datalen() - r_buf->offset < length * sizeof(linkaddr_t))
@@ -411,7 +1362,27 @@ void _handle_packet(uint8_t packet_id, struct protocol_conn *conn)
 		if (length <= 0)
 		{
 			packetbuf_hdrreduce(r_buf->offset);
-			conn->callbacks->sr_recv(conn, hops);
+			if (packet_id == SOURCE_ROUTE_CONTROL_PACKET)
+			{
+				// The payload is a protocol packet
+				uint8_t control_id;
+				_read_packet_id(&control_id);
+#if LATENCY_TRACKING == 1
+				conn->rx_delay = delay;
+#endif
+				// Reliable messages are app data, delivered with the hops of the source route
+				if (control_id == RELIABLE_PACKET)
+					_reliable_recv(conn, hops);
+				else
+					_handle_packet(control_id, conn, from);
+			}
+			else
+			{
+#if LATENCY_TRACKING == 1
+				conn->rx_delay = delay;
+#endif
+				conn->callbacks->sr_recv(conn, hops);
+			}
 		}
 		else
 		{
@@ -435,10 +1406,14 @@ void _handle_packet(uint8_t packet_id, struct protocol_conn *conn)
 			// // ! DEBUG =============
 
 			// Allocate a new buffer to write the header sequentially
-			buffer *w_buf = buffer_allocate_write(sizeof(uint8_t) + sizeof(uint8_t) + (sizeof(linkaddr_t) * length));
+			buffer *w_buf = buffer_allocate_write(SOURCE_ROUTE_HEADER_SIZE + (sizeof(linkaddr_t) * length));
 			// Write route length and hops
 			buffer_write(w_buf, &length, sizeof(uint8_t));
 			buffer_write(w_buf, &hops, sizeof(uint8_t));
+#if LATENCY_TRACKING == 1
+			delay += _elapsed_ms(conn->rx_time);
+			buffer_write(w_buf, &delay, sizeof(uint16_t));
+#endif
 
 			// If there are hops to write, write them all copying them from the dataptr,
 			// skipping the first one exploiting the already correct read buffer offset
@@ -449,16 +1424,129 @@ void _handle_packet(uint8_t packet_id, struct protocol_conn *conn)
 
 			// Cleare the header since we are going to allocate a new one with different size
 			packetbuf_hdrreduce(w_buf->size + sizeof(linkaddr_t));
-			_write_packet_header(SOURCE_ROUTE_PACKET, w_buf->pointer, w_buf->size);
+			int written = _write_packet_header(packet_id, w_buf->pointer, w_buf->size);
 			buffer_free(w_buf);
+			if (!written)
+				return;
 			if (LOG_ENABLED)
 				printf("Protocol: forward to %02x:%02x\n", next_hop.u8[0], next_hop.u8[1]);
 			// Send to the net hop
-			unicast_send(&conn->uc, &next_hop);
+			conn->forwarded++;
+			_send_unicast(conn, &next_hop, conn->rx_class);
 		}
 		buffer_free(r_buf);
 		break;
 	}
+
+	case STORING_ROUTE_PACKET:
+	{
+		if (packetbuf_datalen() < sizeof(struct storing_header))
+		{
+			if (LOG_ENABLED)
+				printf("Protocol error: short storing packet header %d\n", packetbuf_datalen());
+			return;
+		}
+		struct storing_header hdr;
+		memcpy(&hdr, packetbuf_dataptr(), sizeof(hdr));
+		hdr.hops++;
+		packetbuf_hdrreduce(sizeof(hdr));
+		// We are the destination, deliver the packet to the app
+		if (linkaddr_cmp(&hdr.dest, &linkaddr_node_addr) != 0)
+		{
+			conn->callbacks->sr_recv(conn, hdr.hops);
+			break;
+		}
+
+		routing_entry next;
+		if (conn->storing_table == NULL || rtable_get(conn->storing_table, &hdr.dest, &next) < 0)
+		{
+			if (LOG_ENABLED)
+				printf("Protocol error: no next hop stored for %02x:%02x\n", hdr.dest.u8[0], hdr.dest.u8[1]);
+			return;
+		}
+		if (!_write_packet_header(packet_id, &hdr, sizeof(hdr)))
+			return;
+		if (LOG_ENABLED)
+			printf("Protocol: forward to %02x:%02x\n", next.parent.u8[0], next.parent.u8[1]);
+		conn->forwarded++;
+		_send_unicast(conn, &next.parent, conn->rx_class);
+		break;
+	}
+
+	case MULTI_ROUTE_PACKET:
+	{
+		if (packetbuf_datalen() < sizeof(uint8_t) + sizeof(struct multi_route_entry))
+		{
+			if (LOG_ENABLED)
+				printf("Protocol error: short multi route packet header %d\n", packetbuf_datalen());
+			return;
+		}
+		uint8_t hops = *((uint8_t *)packetbuf_dataptr()) + 1;
+		uint16_t length = _multi_route_length((uint8_t *)packetbuf_dataptr() + sizeof(uint8_t), packetbuf_datalen() - sizeof(uint8_t));
+		if (length == 0 || length > MULTI_ROUTE_MAX_NODES * sizeof(struct multi_route_entry))
+		{
+			if (LOG_ENABLED)
+				printf("Protocol error: malformed multi route header %d\n", packetbuf_datalen());
+			return;
+		}
+		// Save the sub-tree and the payload, the packetbuf is rebuilt for every copy
+		uint8_t subtree[MULTI_ROUTE_MAX_NODES * sizeof(struct multi_route_entry)];
+		memcpy(subtree, (uint8_t *)packetbuf_dataptr() + sizeof(uint8_t), length);
+		packetbuf_hdrreduce(sizeof(uint8_t) + length);
+		static uint8_t payload[PACKETBUF_SIZE];
+		uint16_t payload_length = packetbuf_datalen();
+		memcpy(payload, packetbuf_dataptr(), payload_length);
+
+		// The first entry is the current node, duplicate the packet towards each of its children
+		struct multi_route_entry self;
+		memcpy(&self, subtree, sizeof(self));
+		uint16_t offset = sizeof(self);
+		uint8_t i;
+		for (i = 0; i < (self.info & MULTI_ROUTE_CHILDREN_MASK); i++)
+		{
+			uint16_t child_length = _multi_route_length(subtree + offset, length - offset);
+			if (child_length == 0)
+				break;
+			_send_multi_route(conn, hops, subtree + offset, child_length, payload, payload_length);
+			conn->forwarded++;
+			offset += child_length;
+		}
+		if ((self.info & MULTI_ROUTE_DEST) != 0)
+		{
+			packetbuf_clear();
+			packetbuf_copyfrom(payload, payload_length);
+			conn->callbacks->sr_recv(conn, hops);
+		}
+		break;
+	}
+	case FRAGMENT_NACK_PACKET:
+	{
+		struct fragment_nack nack;
+		if (packetbuf_datalen() < sizeof(nack) || conn->fragment_tx.data == NULL)
+			return;
+		memcpy(&nack, packetbuf_dataptr(), sizeof(nack));
+		// Ignore requests for payloads that have already been replaced
+		if (nack.tag != conn->fragment_tx.tag)
+			return;
+		if (LOG_ENABLED)
+			printf("Protocol: sink missing fragments %08lx of tag %u\n", (unsigned long)nack.missing, nack.tag);
+		if (conn->fragment_tx.pending == 0)
+			ctimer_set(&conn->fragment_tx.timer, FORWARD_DELAY, _fragment_timer_cb, conn);
+		conn->fragment_tx.pending |= nack.missing;
+		break;
+	}
+#if LOCAL_REPAIR == 1
+	case REPAIR_REPLY_PACKET:
+	{
+		struct beacon_msg beacon;
+		if (conn->is_sink || packetbuf_datalen() != sizeof(beacon))
+			return;
+		memcpy(&beacon, packetbuf_dataptr(), sizeof(beacon));
+		// Replies arriving after the node reattached still switch it to a better parent
+		_accept_beacon(conn, &beacon, from, packetbuf_attr(PACKETBUF_ATTR_RSSI), true);
+		break;
+	}
+#endif
 	default:
 	{
 		if (LOG_ENABLED)
@@ -468,4 +1556,523 @@ void _handle_packet(uint8_t packet_id, struct protocol_conn *conn)
 	}
 }
 
-#pragma endregion Data
\ No newline at end of file
+#pragma endregion Data
+
+#pragma region Reliable
+
+int send_node_reliable(struct protocol_conn *c, linkaddr_t *dest, uint8_t tclass)
+{
+	if (!c->is_sink || c->reliable == NULL || packetbuf_datalen() > RELIABLE_MAX_PAYLOAD)
+		return -1;
+#if MULTI_SINK == 1
+	linkaddr_t root;
+	// The acknowledgement would reach the other sink, the message cannot be handed over
+	if (_route_root(c->routing_table, dest, &root) && linkaddr_cmp(&root, &linkaddr_node_addr) == 0)
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: %02x:%02x attached to sink %02x:%02x, not reliable\n", dest->u8[0], dest->u8[1], root.u8[0], root.u8[1]);
+		return -1;
+	}
+#endif
+	// The destination only remembers the last message delivered, a single one pending at a time keeps the duplicates apart
+	if (rel_pool_find(c->reliable, RELIABLE_MAX_PENDING, dest) != NULL)
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: reliable message to %02x:%02x already pending\n", dest->u8[0], dest->u8[1]);
+		return -1;
+	}
+	reliable_tx *tx = rel_pool_take(c->reliable, RELIABLE_MAX_PENDING);
+	if (tx == NULL)
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: too many reliable messages pending\n");
+		return -1;
+	}
+	// 0 marks the free slots
+	if (++c->reliable_id == 0)
+		c->reliable_id = 1;
+	tx->id = c->reliable_id;
+	tx->seqn = c->beacon_seqn;
+	tx->dest = *dest;
+	tx->tclass = tclass;
+	tx->retries = 0;
+	tx->length = packetbuf_datalen();
+	memcpy(tx->data, packetbuf_dataptr(), tx->length);
+	_reliable_send(c, tx);
+	return tx->id;
+}
+
+void _reliable_send(struct protocol_conn *conn, reliable_tx *tx)
+{
+	routing_entry entry;
+	reliable_header hdr = {.id = tx->id, .seqn = tx->seqn};
+	packetbuf_clear();
+	packetbuf_copyfrom(tx->data, tx->length);
+	// The route may be learned before the timeout, keep retrying even if it is missing now
+	if (_write_packet_header(RELIABLE_PACKET, &hdr, sizeof(hdr)))
+		_send_source_route(conn, &tx->dest, SOURCE_ROUTE_CONTROL_PACKET, tx->tclass);
+	tx->hops = rtable_get(conn->routing_table, &tx->dest, &entry) >= 0 && entry.depth <= RTABLE_MAX_DEPTH ? entry.depth : 1;
+	tx->sent_at = clock_time();
+	ctimer_set(&tx->timer, rel_timeout(&conn->reliable_rtt, tx->hops, tx->retries), _reliable_timer_cb, tx);
+}
+
+void _reliable_timer_cb(void *ptr)
+{
+	reliable_tx *tx = (reliable_tx *)ptr;
+	struct protocol_conn *conn = (struct protocol_conn *)tx->owner;
+	if (tx->retries >= RELIABLE_MAX_RETRIES)
+	{
+		linkaddr_t dest = tx->dest;
+		uint8_t id = tx->id;
+		rel_release(tx);
+		if (conn->callbacks->delivered != NULL)
+			conn->callbacks->delivered(&dest, id, false);
+		return;
+	}
+	tx->retries++;
+	if (LOG_ENABLED)
+		printf("Protocol: retransmission %u of reliable message %u to %02x:%02x\n", tx->retries, tx->id, tx->dest.u8[0], tx->dest.u8[1]);
+	_reliable_send(conn, tx);
+}
+
+void _reliable_recv(struct protocol_conn *conn, uint8_t hops)
+{
+	reliable_header hdr;
+	if (packetbuf_datalen() < sizeof(hdr))
+		return;
+	memcpy(&hdr, packetbuf_dataptr(), sizeof(hdr));
+	packetbuf_hdrreduce(sizeof(hdr));
+	// A retransmission whose acknowledgement has been lost, acknowledge it again without delivering it twice.
+	// The ids restart when the sink reboots, the seqn of a rebooted sink is a different one
+	if (hdr.id != conn->reliable_id || hdr.seqn != conn->reliable_seqn)
+	{
+		conn->reliable_id = hdr.id;
+		conn->reliable_seqn = hdr.seqn;
+		conn->callbacks->sr_recv(conn, hops);
+	}
+	packetbuf_clear();
+	memcpy(packetbuf_dataptr(), &hdr.id, sizeof(hdr.id));
+	packetbuf_set_datalen(sizeof(hdr.id));
+	_send_sink(conn, PIGGYBACK_FLAG_ACK, conn->rx_class);
+}
+
+void _reliable_ack(struct protocol_conn *conn, const linkaddr_t *source)
+{
+	uint8_t id;
+	if (conn->reliable == NULL || packetbuf_datalen() < sizeof(id))
+		return;
+	memcpy(&id, packetbuf_dataptr(), sizeof(id));
+	reliable_tx *tx = rel_pool_get(conn->reliable, RELIABLE_MAX_PENDING, id, source);
+	// Duplicate acknowledgement
+	if (tx == NULL)
+		return;
+	// The acknowledgement of a retransmission may belong to any of the copies, do not use it for the estimate
+	if (tx->retries == 0)
+		rel_rtt_sample(&conn->reliable_rtt, clock_time() - tx->sent_at, tx->hops);
+	rel_release(tx);
+	if (conn->callbacks->delivered != NULL)
+		conn->callbacks->delivered(source, id, true);
+}
+
+#pragma endregion Reliable
+
+#pragma region Schedule
+
+clock_time_t _network_time(struct protocol_conn *conn)
+{
+	return clock_time() + conn->time_offset;
+}
+
+int _send_upward(struct protocol_conn *conn, uint8_t tclass)
+{
+#if SLOTTED_SCHEDULE == 1
+	_set_class(tclass);
+	if (_backlog_push(conn, &conn->parent, tclass) == 0)
+		return 0;
+
+	// Wait for the beginning of the node slot, deeper nodes transmit earlier in the frame
+	if (conn->backlog_length == 1)
+	{
+		uint16_t depth = conn->hop_to_sink < SLOT_MAX_DEPTH ? conn->hop_to_sink : SLOT_MAX_DEPTH;
+		clock_time_t slot_start = (SLOT_MAX_DEPTH - depth) * SLOT_LENGTH;
+		clock_time_t now = _network_time(conn) % SLOT_FRAME_LENGTH;
+		clock_time_t delay = (slot_start + SLOT_FRAME_LENGTH - now) % SLOT_FRAME_LENGTH;
+		if (LOG_ENABLED)
+			printf("Protocol: waiting %lu ticks for slot of depth %u\n", (unsigned long)delay, depth);
+		ctimer_set(&conn->slot_timer, delay, _slot_timer_cb, conn);
+	}
+	return 1;
+#else
+	return _send_unicast(conn, &conn->parent, tclass);
+#endif
+}
+
+void _slot_timer_cb(void *ptr)
+{
+	struct protocol_conn *conn = (struct protocol_conn *)ptr;
+	// Hand the whole backlog to the MAC, that serializes the transmissions
+	while (conn->backlog_length > 0)
+		_backlog_send(conn, _backlog_next(conn));
+}
+
+#pragma endregion Schedule
+
+#pragma region TrafficClasses
+
+void _set_class(uint8_t tclass)
+{
+#if TRAFFIC_CLASSES == 1
+	static const uint8_t transmissions[] = {TRAFFIC_CRITICAL_TRANSMISSIONS, TRAFFIC_NORMAL_TRANSMISSIONS, TRAFFIC_BULK_TRANSMISSIONS};
+	if (tclass > TRAFFIC_BULK)
+		tclass = TRAFFIC_BULK;
+	// The packet id is the first byte of the header
+	uint8_t *id = (uint8_t *)packetbuf_hdrptr();
+	*id = (*id & PACKET_ID_MASK) | (tclass << PACKET_CLASS_SHIFT);
+	packetbuf_set_attr(PACKETBUF_ATTR_MAX_MAC_TRANSMISSIONS, transmissions[tclass]);
+#endif
+}
+
+int _send_unicast(struct protocol_conn *conn, const linkaddr_t *next_hop, uint8_t tclass)
+{
+	_set_class(tclass);
+#if TRAFFIC_CLASSES == 1 && SLOTTED_SCHEDULE == 0
+	// A single packet at a time in the MAC, so that an urgent packet never waits behind a queue of bulk ones
+	if (conn->tx_busy)
+		return _backlog_push(conn, next_hop, tclass);
+	int res = unicast_send(&conn->uc, next_hop);
+	conn->tx_busy = res != 0;
+	return res;
+#else
+	return unicast_send(&conn->uc, next_hop);
+#endif
+}
+
+int _backlog_push(struct protocol_conn *conn, const linkaddr_t *next_hop, uint8_t tclass)
+{
+#if SLOTTED_SCHEDULE == 1
+	// The backlog holds the traffic of the subtree until the slot, past it the packet leaves ahead of the slot rather than being dropped
+	if (conn->backlog_length >= TX_BACKLOG_SIZE)
+		return _backlog_overflow(conn, next_hop, tclass);
+#endif
+	if (conn->backlog_length >= TX_BACKLOG_SIZE)
+	{
+		// Replace the newest packet of the least urgent class, if less urgent than the new one
+		uint8_t i, victim = 0;
+		for (i = 1; i < conn->backlog_length; i++)
+		{
+			if (conn->backlog[i].tclass >= conn->backlog[victim].tclass)
+				victim = i;
+		}
+		if (TRAFFIC_CLASSES == 0 || conn->backlog[victim].tclass <= tclass)
+		{
+			printf("Protocol: backlog drop class %u\n", tclass);
+			return 0;
+		}
+		printf("Protocol: backlog drop class %u\n", conn->backlog[victim].tclass);
+		queuebuf_free(conn->backlog[victim].packet);
+		conn->backlog_length--;
+		memmove(&conn->backlog[victim], &conn->backlog[victim + 1], (conn->backlog_length - victim) * sizeof(struct backlog_entry));
+	}
+	struct queuebuf *packet = queuebuf_new_from_packetbuf();
+	if (packet == NULL)
+	{
+#if SLOTTED_SCHEDULE == 1
+		return _backlog_overflow(conn, next_hop, tclass);
+#else
+		printf("Protocol: backlog drop class %u\n", tclass);
+		return 0;
+#endif
+	}
+	struct backlog_entry *entry = &conn->backlog[conn->backlog_length++];
+	entry->packet = packet;
+	entry->next_hop = *next_hop;
+	entry->queued_at = clock_time();
+	entry->tclass = tclass;
+	entry->overtaken = 0;
+	return 1;
+}
+
+int _backlog_overflow(struct protocol_conn *conn, const linkaddr_t *next_hop, uint8_t tclass)
+{
+	printf("Protocol: backlog early send class %u\n", tclass);
+	int res = unicast_send(&conn->uc, next_hop);
+	if (res == 0)
+		printf("Protocol: backlog drop class %u\n", tclass);
+	return res;
+}
+
+uint8_t _backlog_next(struct protocol_conn *conn)
+{
+	uint8_t next = 0;
+#if TRAFFIC_CLASSES == 1
+	uint8_t i;
+	// The backlog is in arrival order, pick the oldest of the most urgent class
+	for (i = 1; i < conn->backlog_length; i++)
+	{
+		if (conn->backlog[i].tclass < conn->backlog[next].tclass)
+			next = i;
+	}
+	// Bound the wait of the less urgent packets
+	for (i = 0; i < next && TRAFFIC_MAX_OVERTAKES > 0; i++)
+	{
+		if (conn->backlog[i].overtaken >= TRAFFIC_MAX_OVERTAKES)
+		{
+			next = i;
+			break;
+		}
+	}
+	for (i = 0; i < next; i++)
+		conn->backlog[i].overtaken++;
+#endif
+	return next;
+}
+
+int _backlog_send(struct protocol_conn *conn, uint8_t index)
+{
+	struct backlog_entry entry = conn->backlog[index];
+	conn->backlog_length--;
+	memmove(&conn->backlog[index], &conn->backlog[index + 1], (conn->backlog_length - index) * sizeof(struct backlog_entry));
+
+	queuebuf_to_packetbuf(entry.packet);
+	queuebuf_free(entry.packet);
+#if LATENCY_TRACKING == 1
+	// The headers are now part of the data, account for the time spent in the backlog
+	struct piggyback_header hdr;
+	uint8_t *ptr = (uint8_t *)packetbuf_dataptr();
+	if (packetbuf_datalen() >= sizeof(uint8_t) + sizeof(hdr) && (ptr[0] & PACKET_ID_MASK) == DATA_PACKET)
+	{
+		memcpy(&hdr, ptr + sizeof(uint8_t), sizeof(hdr));
+		hdr.delay += _elapsed_ms(entry.queued_at);
+		memcpy(ptr + sizeof(uint8_t), &hdr, sizeof(hdr));
+	}
+#endif
+	int res = unicast_send(&conn->uc, &entry.next_hop);
+#if TRAFFIC_CLASSES == 1 && SLOTTED_SCHEDULE == 0
+	conn->tx_busy = res != 0;
+	// The MAC refused the packet, the sent callback will not come
+	if (res == 0 && conn->backlog_length > 0)
+		return _backlog_send(conn, _backlog_next(conn));
+#endif
+	return res;
+}
+
+#pragma endregion TrafficClasses
+
+#pragma region Persistence
+
+// state of a node saved in flash
+struct node_state
+{
+	linkaddr_t parent;
+	uint16_t hop_to_sink;
+	uint16_t beacon_seqn;
+	int16_t parent_rssi;
+} __attribute__((packed));
+
+void _restore_state(struct protocol_conn *conn)
+{
+	if (conn->is_sink)
+	{
+		uint16_t length = sizeof(uint16_t) + PERSIST_MAX_ROUTES * sizeof(routing_entry);
+		uint8_t *record = malloc(length);
+		if (record == NULL)
+			return;
+		int res = persist_load("sink", record, length);
+		if (res >= (int)sizeof(uint16_t) && (res - sizeof(uint16_t)) % sizeof(routing_entry) == 0)
+		{
+			uint16_t seqn;
+			memcpy(&seqn, record, sizeof(uint16_t));
+			// Seqns up to the next save may have been used before the reboot, skip them all or the nodes would ignore the beacons
+			conn->beacon_seqn = seqn + PERSIST_SEQN_INTERVAL + 1;
+			rtable_set_epoch(conn->routing_table, conn->beacon_seqn);
+			uint8_t i;
+			for (i = 0; i < (res - sizeof(uint16_t)) / sizeof(routing_entry); i++)
+			{
+				routing_entry entry;
+				memcpy(&entry, record + sizeof(uint16_t) + i * sizeof(routing_entry), sizeof(entry));
+				if (linkaddr_cmp(&entry.child, &linkaddr_null) != 0 || linkaddr_cmp(&entry.parent, &linkaddr_null) != 0 ||
+					linkaddr_cmp(&entry.child, &entry.parent) != 0)
+					continue;
+				rtable_add(conn->routing_table, &entry);
+			}
+			printf("Protocol: restored %u routes, beacon seqn %u\n", conn->routing_table->_used, conn->beacon_seqn);
+		}
+		free(record);
+		return;
+	}
+
+	struct node_state state;
+	if (persist_load("node", &state, sizeof(state)) != sizeof(state))
+		return;
+	if (linkaddr_cmp(&state.parent, &linkaddr_null) != 0 || linkaddr_cmp(&state.parent, &linkaddr_node_addr) != 0 ||
+		state.hop_to_sink == 0 || state.hop_to_sink == UINT16_MAX)
+		return;
+	conn->parent = state.parent;
+	conn->hop_to_sink = state.hop_to_sink;
+	conn->beacon_seqn = state.beacon_seqn;
+	conn->parent_rssi = state.parent_rssi;
+	printf("Protocol: restored parent %02x:%02x, hop_to_sink %u, seqn %u\n",
+		   conn->parent.u8[0], conn->parent.u8[1], conn->hop_to_sink, conn->beacon_seqn);
+	// The sink may have lost its routing table, let it know where we are as soon as possible
+	_mark_topology_dirty(conn);
+}
+
+void _persist_node(struct protocol_conn *conn)
+{
+	struct node_state state = {
+		.parent = conn->parent,
+		.hop_to_sink = conn->hop_to_sink,
+		.beacon_seqn = conn->beacon_seqn,
+		.parent_rssi = conn->parent_rssi};
+	if (!persist_save("node", &state, sizeof(state)) && LOG_ENABLED)
+		printf("Protocol error: could not save the node state\n");
+}
+
+void _schedule_persist(struct protocol_conn *conn)
+{
+	// Batch the updates, flash writes are expensive
+	if (ctimer_expired(&conn->persist_timer))
+		ctimer_set(&conn->persist_timer, PERSIST_DELAY, _persist_timer_cb, conn);
+}
+
+void _persist_timer_cb(void *ptr)
+{
+	struct protocol_conn *conn = (struct protocol_conn *)ptr;
+	uint8_t routes = conn->routing_table->_used < PERSIST_MAX_ROUTES ? conn->routing_table->_used : PERSIST_MAX_ROUTES;
+	buffer *w_buf = buffer_allocate_write(sizeof(uint16_t) + routes * sizeof(routing_entry));
+	buffer_write(w_buf, &conn->beacon_seqn, sizeof(uint16_t));
+	buffer_write(w_buf, conn->routing_table->entries, routes * sizeof(routing_entry));
+	if (!persist_save("sink", w_buf->pointer, w_buf->size) && LOG_ENABLED)
+		printf("Protocol error: could not save the sink state\n");
+	buffer_free(w_buf);
+}
+
+#pragma endregion Persistence
+
+#pragma region Fragmentation
+
+int send_sink_bulk(struct protocol_conn *c, const void *data, uint16_t length)
+{
+	if (c->fragment_tx.data == NULL || length == 0 || length > FRAGMENT_MAX_SIZE)
+		return -1;
+	// The previous payload is still being sent
+	if (c->fragment_tx.pending != 0)
+		return -1;
+	// A new tag makes the node ignore retransmission requests for the previous payload
+	c->fragment_tx.tag++;
+	c->fragment_tx.length = length;
+	memcpy(c->fragment_tx.data, data, length);
+	uint8_t count = frag_count(length);
+	c->fragment_tx.pending = count >= 32 ? UINT32_MAX : ((uint32_t)1 << count) - 1;
+	_fragment_timer_cb(c);
+	return count;
+}
+
+void _fragment_timer_cb(void *ptr)
+{
+	struct protocol_conn *conn = (struct protocol_conn *)ptr;
+	fragment_tx *tx = &conn->fragment_tx;
+	if (tx->pending == 0)
+		return;
+
+	// Send the first pending fragment
+	uint8_t index = 0;
+	while ((tx->pending & ((uint32_t)1 << index)) == 0)
+		index++;
+	tx->pending &= ~((uint32_t)1 << index);
+
+	fragment_header hdr = {.tag = tx->tag, .index = index, .count = frag_count(tx->length)};
+	uint16_t offset = (uint16_t)index * FRAGMENT_PAYLOAD_SIZE;
+	uint16_t length = tx->length - offset < FRAGMENT_PAYLOAD_SIZE ? tx->length - offset : FRAGMENT_PAYLOAD_SIZE;
+	packetbuf_clear();
+	memcpy(packetbuf_dataptr(), &hdr, sizeof(hdr));
+	memcpy((uint8_t *)packetbuf_dataptr() + sizeof(hdr), tx->data + offset, length);
+	packetbuf_set_datalen(sizeof(hdr) + length);
+	if (LOG_ENABLED)
+		printf("Protocol: send fragment %u/%u of tag %u\n", index + 1, hdr.count, hdr.tag);
+	_send_sink(conn, PIGGYBACK_FLAG_FRAGMENT, TRAFFIC_BULK);
+
+	if (tx->pending != 0)
+		ctimer_set(&tx->timer, FRAGMENT_INTERVAL, _fragment_timer_cb, conn);
+}
+
+void _fragment_recv(struct protocol_conn *conn, const linkaddr_t *source, uint8_t hops)
+{
+	fragment_header hdr;
+	if (conn->reassembly == NULL || packetbuf_datalen() < sizeof(hdr))
+		return;
+	memcpy(&hdr, packetbuf_dataptr(), sizeof(hdr));
+	packetbuf_hdrreduce(sizeof(hdr));
+	if (hdr.count == 0 || hdr.count > 32 || (uint16_t)(hdr.count - 1) * FRAGMENT_PAYLOAD_SIZE >= FRAGMENT_MAX_SIZE)
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: bulk payload of %u fragments is too large\n", hdr.count);
+		return;
+	}
+
+	reassembly_buffer *buf = frag_pool_get(conn->reassembly, FRAGMENT_BUFFERS, source, hdr.tag, hdr.count);
+	if (buf == NULL)
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: no reassembly buffer for %02x:%02x\n", source->u8[0], source->u8[1]);
+		return;
+	}
+	// Duplicate of a payload already delivered
+	if (buf->delivered == buf->count)
+		return;
+	if (!frag_store(buf, hdr.index, packetbuf_dataptr(), packetbuf_datalen()))
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: invalid fragment %u of %02x:%02x\n", hdr.index, source->u8[0], source->u8[1]);
+		return;
+	}
+
+	// Deliver to the app what can be delivered in order
+	uint8_t delivered = buf->delivered;
+	while (buf->delivered < buf->count && (buf->received & ((uint32_t)1 << buf->delivered)) != 0)
+		buf->delivered++;
+	if (buf->delivered > delivered)
+	{
+		uint16_t offset = frag_contiguous_length(buf, delivered);
+		uint16_t length = frag_contiguous_length(buf, buf->delivered) - offset;
+		bool complete = buf->delivered == buf->count;
+		if (conn->callbacks->bulk_recv != NULL)
+			conn->callbacks->bulk_recv(&buf->source, buf->data, offset, length, complete, hops);
+		if (complete)
+		{
+			// Keep the buffer until it is reused to recognize duplicates
+			ctimer_stop(&buf->timer);
+			return;
+		}
+	}
+	// Give the source some more time every time a fragment arrives
+	ctimer_set(&buf->timer, FRAGMENT_TIMEOUT, _reassembly_timer_cb, buf);
+}
+
+void _reassembly_timer_cb(void *ptr)
+{
+	reassembly_buffer *buf = (reassembly_buffer *)ptr;
+	struct protocol_conn *conn = (struct protocol_conn *)buf->owner;
+	if (buf->retries >= FRAGMENT_MAX_RETRIES)
+	{
+		if (LOG_ENABLED)
+			printf("Protocol error: discarding incomplete bulk payload of %02x:%02x\n", buf->source.u8[0], buf->source.u8[1]);
+		frag_release(buf);
+		return;
+	}
+	buf->retries++;
+
+	// Ask the source for the missing fragments only
+	struct fragment_nack nack = {.tag = buf->tag, .missing = frag_missing(buf)};
+	linkaddr_t source = buf->source;
+	packetbuf_clear();
+	if (_write_packet_header(FRAGMENT_NACK_PACKET, &nack, sizeof(nack)))
+	{
+		if (LOG_ENABLED)
+			printf("Protocol: request fragments %08lx to %02x:%02x\n", (unsigned long)nack.missing, source.u8[0], source.u8[1]);
+		_send_source_route(conn, &source, SOURCE_ROUTE_CONTROL_PACKET, TRAFFIC_NORMAL);
+	}
+	ctimer_set(&buf->timer, FRAGMENT_TIMEOUT, _reassembly_timer_cb, buf);
+}
+
+#pragma endregion Fragmentation
\ No newline at end of file
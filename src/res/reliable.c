@@ -0,0 +1,88 @@
+#include "src/include/reliable.h"
+
+reliable_tx *rel_pool_alloc(uint8_t size, void *owner)
+{
+    reliable_tx *pool = malloc(sizeof(reliable_tx) * size);
+    if (pool == NULL)
+        return NULL;
+    uint8_t i = 0;
+    for (i = 0; i < size; i++)
+    {
+        pool[i].id = 0;
+        pool[i].owner = owner;
+    }
+    return pool;
+}
+
+reliable_tx *rel_pool_get(reliable_tx *pool, uint8_t size, uint8_t id, const linkaddr_t *dest)
+{
+    uint8_t i = 0;
+    for (i = 0; i < size; i++)
+    {
+        if (id != 0 && pool[i].id == id && linkaddr_cmp(dest, &pool[i].dest) != 0)
+            return &pool[i];
+    }
+    return NULL;
+}
+
+reliable_tx *rel_pool_find(reliable_tx *pool, uint8_t size, const linkaddr_t *dest)
+{
+    uint8_t i = 0;
+    for (i = 0; i < size; i++)
+    {
+        if (pool[i].id != 0 && linkaddr_cmp(dest, &pool[i].dest) != 0)
+            return &pool[i];
+    }
+    return NULL;
+}
+
+reliable_tx *rel_pool_take(reliable_tx *pool, uint8_t size)
+{
+    uint8_t i = 0;
+    for (i = 0; i < size; i++)
+    {
+        if (pool[i].id == 0)
+            return &pool[i];
+    }
+    return NULL;
+}
+
+void rel_release(reliable_tx *tx)
+{
+    ctimer_stop(&tx->timer);
+    tx->id = 0;
+}
+
+void rel_rtt_sample(reliable_rtt *rtt, clock_time_t sample, uint8_t hops)
+{
+    // The estimate is kept per hop, so that routes of any length share it
+    int32_t m = sample / (hops > 0 ? hops : 1);
+    if (rtt->srtt == 0)
+    {
+        // Never 0 again, even if the first sample is
+        rtt->srtt = (m << 3) + 1;
+        rtt->rttvar = m << 1;
+        return;
+    }
+    m -= rtt->srtt >> 3;
+    rtt->srtt += m;
+    if (m < 0)
+        m = -m;
+    m -= rtt->rttvar >> 2;
+    rtt->rttvar += m;
+}
+
+clock_time_t rel_timeout(const reliable_rtt *rtt, uint8_t hops, uint8_t retries)
+{
+    int32_t hop_timeout = rtt->srtt == 0 ? RELIABLE_HOP_TIMEOUT : (rtt->srtt >> 3) + rtt->rttvar;
+    if (hop_timeout < RELIABLE_MIN_HOP_TIMEOUT)
+        hop_timeout = RELIABLE_MIN_HOP_TIMEOUT;
+    if (hop_timeout > RELIABLE_MAX_TIMEOUT)
+        hop_timeout = RELIABLE_MAX_TIMEOUT;
+    // clock_time_t is 16 bits on the Sky, the product of a long route would wrap
+    uint32_t timeout = (uint32_t)hop_timeout * (hops > 0 ? hops : 1);
+    // Exponential backoff, a congested route is not flooded with retries
+    for (; retries > 0 && timeout < RELIABLE_MAX_TIMEOUT; retries--)
+        timeout <<= 1;
+    return timeout < RELIABLE_MAX_TIMEOUT ? (clock_time_t)timeout : RELIABLE_MAX_TIMEOUT;
+}
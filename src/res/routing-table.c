@@ -1,13 +1,17 @@
 #include "src/include/routing-table.h"
 
-routing_table *rtable_alloc(uint8_t size, bool allow_resize)
+static void rtable_reindex(routing_table *table, uint8_t index);
+static void rtable_reindex_children(routing_table *table, const linkaddr_t *node);
+
+routing_table *rtable_alloc(uint8_t size, uint8_t flags)
 {
     routing_table *table = malloc(sizeof(routing_table));
     if (table == NULL)
         return NULL;
     table->size = size;
     table->_used = 0;
-    table->allow_resize = allow_resize;
+    table->flags = flags;
+    table->epoch = 0;
     table->entries = malloc(sizeof(routing_entry) * size);
     return table;
 }
@@ -15,13 +19,13 @@ routing_table *rtable_alloc(uint8_t size, bool allow_resize)
 int rtable_get(routing_table *table, linkaddr_t *child, routing_entry *entry)
 {
     uint8_t i = 0;
-    for (i = 0; i < table->size; i++)
+    // Only the first _used entries are initialized
+    for (i = 0; i < table->_used; i++)
     {
         routing_entry current = (table->entries)[i];
         if (linkaddr_cmp(child, &(current.child)) != 0)
         {
-            entry->child = current.child;
-            entry->parent = current.parent;
+            *entry = current;
             return i;
         }
     }
@@ -35,35 +39,205 @@ bool rtable_update(routing_table *table, routing_entry *entry)
     if (index < 0)
         return false;
     table->entries[index] = *entry;
+    table->entries[index].epoch = table->epoch;
+    table->entries[index].depth = e.depth;
+    if ((table->flags & RTABLE_TREE_INDEX) != 0 && linkaddr_cmp(&e.parent, &entry->parent) == 0)
+        rtable_reindex(table, index);
     return true;
 }
 
-bool rtable_add(routing_table *table, routing_entry *entry)
+// Remove the entry at [index], the last entry is moved in its place so that the valid entries stay contiguous
+static void rtable_remove_at(routing_table *table, uint8_t index)
 {
-    routing_entry dummy;
-    if (rtable_get(table, &entry->child, &dummy) >= 0)
-        return false;
-    if (table->_used > table->size - 1)
+    linkaddr_t child = table->entries[index].child;
+    table->_used--;
+    table->entries[index] = table->entries[table->_used];
+    // The sub-tree of the entry is no longer connected
+    if ((table->flags & RTABLE_TREE_INDEX) != 0)
+        rtable_reindex_children(table, &child);
+}
+
+// Depth of [entry] given the depth of its parent
+static uint8_t rtable_depth_below(routing_table *table, routing_entry *entry)
+{
+    routing_entry parent;
+    if (linkaddr_cmp(&entry->parent, &linkaddr_node_addr) != 0)
+        return 1;
+    if (rtable_get(table, &entry->parent, &parent) < 0)
+        return RTABLE_DEPTH_UNKNOWN;
+    if (parent.depth > RTABLE_MAX_DEPTH)
+        return parent.depth;
+    return parent.depth == RTABLE_MAX_DEPTH ? RTABLE_DEPTH_UNKNOWN : parent.depth + 1;
+}
+
+// Whether [target] is met walking the parents from [node]
+static bool rtable_in_chain(routing_table *table, const linkaddr_t *node, const linkaddr_t *target)
+{
+    routing_entry entry;
+    linkaddr_t current = *node;
+    uint16_t steps = 0;
+    // A longer chain is a loop not including the target
+    for (steps = 0; steps <= table->_used; steps++)
     {
-        if (!table->allow_resize)
-        {
+        if (linkaddr_cmp(&current, target) != 0)
+            return true;
+        if (rtable_get(table, &current, &entry) < 0)
             return false;
-        }
-        else
+        current = entry.parent;
+    }
+    return false;
+}
+
+// Recompute the depth of the entries whose parent is [node], and of their sub-trees in breadth first order
+static void rtable_reindex_children(routing_table *table, const linkaddr_t *node)
+{
+    if (table->_used == 0)
+        return;
+    uint8_t *queue = malloc(table->_used);
+    if (queue == NULL)
+        return;
+    uint8_t head = 0, tail = 0, queued = 0;
+    uint8_t i = 0;
+    linkaddr_t current = *node;
+    while (true)
+    {
+        for (i = 0; i < table->_used; i++)
         {
-            uint16_t newSize = table->size * 2;
-            void *dest = malloc(sizeof(routing_entry) * newSize);
-            table->entries = memcpy(dest, table->entries, sizeof(routing_entry) * table->size);
-            table->size = newSize;
+            routing_entry *entry = &table->entries[i];
+            if (linkaddr_cmp(&entry->parent, &current) == 0)
+                continue;
+            uint8_t depth = rtable_depth_below(table, entry);
+            // Unchanged entries have an unchanged sub-tree
+            if (depth == entry->depth || queued == table->_used)
+                continue;
+            entry->depth = depth;
+            queue[tail] = i;
+            tail = (tail + 1) % table->_used;
+            queued++;
         }
+        if (queued == 0)
+            break;
+        current = table->entries[queue[head]].child;
+        head = (head + 1) % table->_used;
+        queued--;
     }
+    free(queue);
+}
+
+// Update the depth of the entry at [index] after a change of its parent, detecting loops once here
+static void rtable_reindex(routing_table *table, uint8_t index)
+{
+    routing_entry *entry = &table->entries[index];
+    if (rtable_in_chain(table, &entry->parent, &entry->child))
+        entry->depth = RTABLE_DEPTH_LOOP;
+    else
+        entry->depth = rtable_depth_below(table, entry);
+    rtable_reindex_children(table, &entry->child);
+}
+
+// Index of the least recently refreshed entry
+static uint8_t rtable_stalest(routing_table *table)
+{
+    uint8_t i = 0;
+    uint8_t stalest = 0;
+    for (i = 1; i < table->_used; i++)
+    {
+        // Epochs may wrap, compare the ages
+        if ((uint16_t)(table->epoch - table->entries[i].epoch) > (uint16_t)(table->epoch - table->entries[stalest].epoch))
+            stalest = i;
+    }
+    return stalest;
+}
+
+// Double the size of the table, up to UINT8_MAX entries. Returns false if the table cannot grow
+static bool rtable_grow(routing_table *table)
+{
+    if (table->size == UINT8_MAX)
+        return false;
+    uint8_t new_size = table->size > UINT8_MAX / 2 ? UINT8_MAX : table->size * 2;
+    routing_entry *entries = malloc(sizeof(routing_entry) * new_size);
+    if (entries == NULL)
+        return false;
+    memcpy(entries, table->entries, sizeof(routing_entry) * table->_used);
+    free(table->entries);
+    table->entries = entries;
+    table->size = new_size;
+    return true;
+}
+
+// Make room for a new entry in a full table. Returns false if the flags do not allow it
+static bool rtable_make_room(routing_table *table)
+{
+    bool evict = (table->flags & RTABLE_ALLOW_EVICT) != 0 && table->_used > 0;
+    uint8_t stalest = rtable_stalest(table);
+    // Prefer replacing an entry no longer refreshed over growing the table, see RTABLE_EVICT_EPOCHS
+    if (evict && (uint16_t)(table->epoch - table->entries[stalest].epoch) >= RTABLE_EVICT_EPOCHS)
+    {
+        rtable_remove_at(table, stalest);
+        return true;
+    }
+    if ((table->flags & RTABLE_ALLOW_RESIZE) != 0 && rtable_grow(table))
+        return true;
+    if (evict)
+    {
+        rtable_remove_at(table, stalest);
+        return true;
+    }
+    return false;
+}
+
+bool rtable_add(routing_table *table, routing_entry *entry)
+{
+    routing_entry dummy;
+    if (rtable_get(table, &entry->child, &dummy) >= 0)
+        return false;
+    if (table->_used >= table->size && !rtable_make_room(table))
+        return false;
     table->entries[table->_used] = *entry;
+    table->entries[table->_used].epoch = table->epoch;
     table->_used++;
+    if ((table->flags & RTABLE_TREE_INDEX) != 0)
+        rtable_reindex(table, table->_used - 1);
+    return true;
+}
+
+bool rtable_remove(routing_table *table, linkaddr_t *child)
+{
+    routing_entry dummy;
+    int index = rtable_get(table, child, &dummy);
+    if (index < 0)
+        return false;
+    rtable_remove_at(table, index);
     return true;
 }
 
+void rtable_set_epoch(routing_table *table, uint16_t epoch)
+{
+    table->epoch = epoch;
+}
+
+uint8_t rtable_expire(routing_table *table, uint16_t max_age, void (*removed)(routing_entry *entry))
+{
+    uint8_t i = 0;
+    uint8_t count = 0;
+    while (i < table->_used)
+    {
+        if ((uint16_t)(table->epoch - table->entries[i].epoch) <= max_age)
+        {
+            i++;
+            continue;
+        }
+        if (removed != NULL)
+            removed(&table->entries[i]);
+        // The last entry takes this place, check it at the same index
+        rtable_remove_at(table, i);
+        count++;
+    }
+    return count;
+}
+
 void rtable_free(routing_table *table)
 {
     free(table->entries);
     free(table);
-}
\ No newline at end of file
+}
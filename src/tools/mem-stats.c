@@ -0,0 +1,131 @@
+/**
+ * \file
+ *         Memory instrumentation, see mem-stats.h.
+ *
+ *         At start the RAM between the heap break and the current stack
+ *         pointer is painted with a pattern. The stack grows downwards into
+ *         it and the heap upwards, the bytes still painted between the two
+ *         are the RAM never used so far.
+ *
+ *         The stack peak is counted from the top of the stack, the initial
+ *         stack pointer of the msp430 linker script. On the other platforms
+ *         the top is unknown: the peak is the depth below the frame of
+ *         mem_stats_start, without main and the frames of the scheduler.
+ */
+
+#include "mem-stats.h"
+#include <stdio.h>
+/* The accounting itself uses the allocator of the libc */
+#undef malloc
+#undef free
+/*---------------------------------------------------------------------------*/
+#define STACK_PATTERN 0xA5
+/* Left unpainted below the stack pointer, used by mem_stats_start itself */
+#define STACK_MARGIN 32
+/* Same period as the energest reports */
+#define REPORT_PERIOD (15 * CLOCK_SECOND)
+/*---------------------------------------------------------------------------*/
+/* Heap break, provided by the platform (msp430.c on the Sky, newlib on the Zoul) */
+void *sbrk(int incr);
+#ifdef __MSP430__
+/* Initial stack pointer, at the end of the RAM */
+extern uint8_t __stack;
+#endif
+/*---------------------------------------------------------------------------*/
+/* Prepended to every block to know its size when freed, aligned as malloc */
+typedef union {
+  size_t size;
+  long align;
+} mem_header;
+/*---------------------------------------------------------------------------*/
+static uint16_t cnt;
+static size_t heap_used, heap_peak;
+static uint16_t failures;
+/* Painted region, the top is the stack pointer when painted */
+static uint8_t *paint_low, *paint_high;
+/* Origin of the stack peak */
+static uint8_t *stack_top;
+/*---------------------------------------------------------------------------*/
+PROCESS(mem_stats_process, "Memory Stats Process");
+/*---------------------------------------------------------------------------*/
+void *mem_stats_malloc(size_t size)
+{
+  mem_header *header = malloc(sizeof(mem_header) + size);
+  if(header == NULL) {
+    failures++;
+    return NULL;
+  }
+  header->size = size;
+  heap_used += size;
+  if(heap_used > heap_peak) {
+    heap_peak = heap_used;
+  }
+  return header + 1;
+}
+/*---------------------------------------------------------------------------*/
+void mem_stats_free(void *ptr)
+{
+  mem_header *header;
+  if(ptr == NULL) {
+    return;
+  }
+  header = (mem_header *)ptr - 1;
+  heap_used -= header->size;
+  free(header);
+}
+/*---------------------------------------------------------------------------*/
+void mem_stats_start(void)
+{
+  volatile uint8_t marker;
+  uint8_t *p;
+
+  paint_low = (uint8_t *)sbrk(0);
+  paint_high = (uint8_t *)&marker - STACK_MARGIN;
+#ifdef __MSP430__
+  stack_top = &__stack;
+#else
+  stack_top = (uint8_t *)&marker;
+#endif
+  for(p = paint_low; p < paint_high; p++) {
+    *p = STACK_PATTERN;
+  }
+
+  /* Start Memory Stats Printing Process */
+  process_start(&mem_stats_process, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void mem_stats_step(void)
+{
+  uint8_t *brk = (uint8_t *)sbrk(0);
+  uint8_t *p = brk > paint_low ? brk : paint_low;
+  uint8_t *free_low = p;
+
+  /* The deepest stack frame is the first byte not painted above the heap */
+  while(p < paint_high && *p == STACK_PATTERN) {
+    p++;
+  }
+
+  printf("Memory: %u %u %u %u %u %u\n",
+         cnt++,
+         (unsigned)heap_used,
+         (unsigned)heap_peak,
+         (unsigned)(stack_top - p),
+         (unsigned)(p - free_low),
+         failures);
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(mem_stats_process, ev, data)
+{
+  static struct etimer periodic;
+  PROCESS_BEGIN();
+  etimer_set(&periodic, REPORT_PERIOD);
+
+  while (1)
+  {
+    PROCESS_WAIT_UNTIL(etimer_expired(&periodic));
+    etimer_reset(&periodic);
+    mem_stats_step();
+  }
+
+  PROCESS_END();
+}
@@ -0,0 +1,32 @@
+/**
+ * \file
+ *         Memory instrumentation: heap bytes in use and high-water mark
+ *         of the protocol allocations, and stack high-water mark measured
+ *         by painting the free RAM. Enabled by MEM_STATS in params.h.
+ *
+ *         Report: Memory: cnt heap heap_peak stack_peak free_ram failures
+ *
+ *         stack_peak is counted from the top of the stack on the Sky, from
+ *         the frame of mem_stats_start on the other platforms.
+ */
+
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+/*---------------------------------------------------------------------------*/
+#include "contiki.h"
+#include <stdlib.h>
+#include "params.h"
+/*---------------------------------------------------------------------------*/
+void mem_stats_start(void);
+void mem_stats_step(void);
+/* Allocations accounted in the report, every block must be freed with mem_stats_free */
+void *mem_stats_malloc(size_t size);
+void mem_stats_free(void *ptr);
+/*---------------------------------------------------------------------------*/
+/* The sources including this header account their allocations */
+#if MEM_STATS == 1
+#define malloc(size) mem_stats_malloc(size)
+#define free(ptr) mem_stats_free(ptr)
+#endif
+/*---------------------------------------------------------------------------*/
+#endif /* MEM_STATS_H */
@@ -54,6 +54,7 @@ static uint16_t cnt;
 static uint32_t last_cpu, last_lpm, last_tx, last_rx;
 static uint32_t delta_cpu, delta_lpm, delta_tx, delta_rx;
 static uint32_t curr_cpu, curr_lpm, curr_tx, curr_rx;
+static uint16_t radio_permille;
 /*---------------------------------------------------------------------------*/
 PROCESS(energest_process, "Energest Process");
 /*---------------------------------------------------------------------------*/
@@ -89,6 +90,10 @@ void simple_energest_step(void)
   last_tx = curr_tx;
   last_rx = curr_rx;
 
+  if(delta_cpu + delta_lpm > 0) {
+    radio_permille = (uint16_t)(((delta_tx + delta_rx) * 1000) / (delta_cpu + delta_lpm));
+  }
+
   PRINTF("Energest: %u %lu %lu %lu %lu\n",
          cnt++,
          delta_cpu,
@@ -97,6 +102,11 @@ void simple_energest_step(void)
          delta_rx);
 }
 /*---------------------------------------------------------------------------*/
+uint16_t simple_energest_radio_permille(void)
+{
+  return radio_permille;
+}
+/*---------------------------------------------------------------------------*/
 PROCESS_THREAD(energest_process, ev, data)
 {
   static struct etimer periodic;
@@ -40,5 +40,7 @@
 /*---------------------------------------------------------------------------*/
 void simple_energest_start(void);
 void simple_energest_step(void);
+/* Radio on time over the last period, in per mille */
+uint16_t simple_energest_radio_permille(void);
 /*---------------------------------------------------------------------------*/
 #endif /* SIMPLE_ENERGEST_H */
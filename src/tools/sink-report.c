@@ -0,0 +1,27 @@
+/**
+ * \file
+ *         Compact framed binary reports written by the sink on the serial
+ *         line. At high packet rates the text reports make the UART the
+ *         bottleneck, a frame is about a third of the equivalent text line.
+ */
+
+#include "sink-report.h"
+#include <stdio.h>
+/*---------------------------------------------------------------------------*/
+void sink_report(uint8_t type, const void *data, uint8_t length)
+{
+  const uint8_t *payload = (const uint8_t *)data;
+  uint8_t checksum = type ^ length;
+  uint8_t i;
+
+  putchar(SINK_REPORT_SYNC1);
+  putchar(SINK_REPORT_SYNC2);
+  putchar(type);
+  putchar(length);
+  for(i = 0; i < length; i++) {
+    putchar(payload[i]);
+    checksum ^= payload[i];
+  }
+  putchar(checksum);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,37 @@
+/**
+ * \file
+ *         Compact framed binary reports written by the sink on the serial
+ *         line, decoded by gateway.py.
+ *
+ *         Frame: 0xA5 0x5A | type | length | payload | checksum
+ *         where checksum is the XOR of type, length and payload bytes.
+ */
+
+#ifndef SINK_REPORT_H
+#define SINK_REPORT_H
+/*---------------------------------------------------------------------------*/
+#include "contiki.h"
+#include "core/net/linkaddr.h"
+/*---------------------------------------------------------------------------*/
+#define SINK_REPORT_SYNC1 0xA5
+#define SINK_REPORT_SYNC2 0x5A
+
+/* Data packet received by the sink: source, seqn, hops */
+#define SINK_REPORT_RECV 1
+/* Downward packet sent by the sink: destination, seqn */
+#define SINK_REPORT_SR_SENT 2
+/*---------------------------------------------------------------------------*/
+struct sink_report_recv {
+  linkaddr_t source;
+  uint16_t seqn;
+  uint8_t hops;
+} __attribute__((packed));
+
+struct sink_report_sr_sent {
+  linkaddr_t dest;
+  uint16_t seqn;
+} __attribute__((packed));
+/*---------------------------------------------------------------------------*/
+void sink_report(uint8_t type, const void *data, uint8_t length);
+/*---------------------------------------------------------------------------*/
+#endif /* SINK_REPORT_H */
@@ -355,6 +355,8 @@
               var newX = cos * x - sin * y;
               var newY = sin*x + cos * y;
               sinkMotePos.setCoordinates(newX, newY, z); 
+              // Mark the disturbance for parse-topology.py
+              outputs.write(time + "\tID:" + allm[0].getID() + "\tDisturbance: sink moved\n");
               num = 0;
             }
             //This is the tricky part. The Script is terminated using
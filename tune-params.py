@@ -0,0 +1,291 @@
+#!/usr/bin/env python3
+
+# Tunes the timing constants of src/include/params.h for a deployment profile.
+# Candidates are sampled from the parameter space and run on the Cooja scenarios
+# of the profile with run-experiments.py, the bad ones are stopped early by
+# successive halving: every rung runs the survivors on more seeds and keeps the
+# best fraction by score. The score weighs PDR, duty cycle, control overhead
+# and latency relative to the defaults of params.h, which are always evaluated:
+#   score = w_pdr * pdr / pdr_default - w_dc * dc / dc_default - ...
+#
+# For every profile the Pareto front of the last rung is printed, and the best
+# candidate is saved in <out>/tuning/<profile>.conf, to be built with
+#   make PARAMS_CONF=experiments/tuning/dense.conf
+#
+# The sparse and dense profiles run test_nogui.csc with the mote positions
+# scaled, the mobile profile the dynamic scenario.
+#
+# Examples:
+#   ./tune-params.py -c 24 -n 4
+#   ./tune-params.py --profile dense=test_nogui.csc@0.6,test_nogui_mrm.csc@0.6 \
+#       -p "BEACON_PERIOD=(20*CLOCK_SECOND),(40*CLOCK_SECOND)" -p RSSI_THRESHOLD=-90,-85
+
+from __future__ import division
+
+import re
+import os
+import sys
+import math
+import random
+import argparse
+import itertools
+import importlib.util
+
+base_dir = os.path.dirname(os.path.abspath(__file__))
+
+# Values tried for every parameter, the values of params.h are the baseline.
+# MSG_INIT_DELAY follows from the other delays and is left derived
+default_space = [
+    ("BEACON_PERIOD", ["(15*CLOCK_SECOND)", "(30*CLOCK_SECOND)", "(60*CLOCK_SECOND)", "(120*CLOCK_SECOND)"]),
+    ("TOPOLOGY_UPDATE_DELAY", ["(BEACON_PERIOD/12)", "(BEACON_PERIOD/6)", "(BEACON_PERIOD/3)"]),
+    ("FORWARD_DELAY", ["(random_rand()%(CLOCK_SECOND/4))", "(random_rand()%(CLOCK_SECOND/2))",
+                       "(random_rand()%CLOCK_SECOND)"]),
+    ("RSSI_THRESHOLD", ["-95", "-90", "-85"]),
+    ("ROUTE_EXPIRY_EPOCHS", ["4", "8", "16"]),
+]
+
+# Scenarios of every profile, with the scale of the mote positions
+default_profiles = {
+    "sparse": [("test_nogui.csc", 1.2)],
+    "dense": [("test_nogui.csc", 0.6)],
+    "mobile": [("test_nogui_dynamic.csc", 1.0)],
+}
+
+# Metrics of the objective: (name, True when higher is better)
+objectives = [("pdr", True), ("duty_cycle", False), ("control", False), ("latency_p50", False)]
+default_weights = "pdr=1,duty_cycle=0.5,control=0.25,latency_p50=0.25"
+
+
+def load_experiments():
+    # Reuse the runner and the cache of run-experiments.py
+    path = os.path.join(base_dir, "run-experiments.py")
+    spec = importlib.util.spec_from_file_location("run_experiments", path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def scaled_scenario(scenario, scale, out_dir):
+    # Copy of the scenario with the distances between the motes scaled
+    if scale == 1:
+        return scenario
+    with open(os.path.join(base_dir, scenario), 'r') as f:
+        csc = f.read()
+    csc = re.sub(r"<(?P<axis>[xy])>(?P<v>-?[\d.]+)</(?P=axis)>",
+                 lambda m: "<{0}>{1}</{0}>".format(m.group("axis"), float(m.group("v")) * scale), csc)
+    path = os.path.join(out_dir, "{}-x{}.csc".format(os.path.splitext(os.path.basename(scenario))[0], scale))
+    with open(path, 'w') as f:
+        f.write(csc)
+    return path
+
+
+def sample_candidates(space, count, rng):
+    # The defaults first, then distinct random combinations, or all of them when they are fewer
+    names = [name for name, _ in space]
+    combos = list(itertools.product(*[values for _, values in space]))
+    if len(combos) > count - 1:
+        combos = rng.sample(combos, count - 1)
+    return [{}] + [dict(zip(names, combo)) for combo in combos]
+
+
+def mean_metrics(results):
+    metrics = {}
+    for name, _ in objectives:
+        values = [r["metrics"][name] for r in results if name in r["metrics"]]
+        if values:
+            metrics[name] = sum(values) / len(values)
+    return metrics
+
+
+def score(metrics, baseline, weights):
+    total = 0
+    for name, higher in objectives:
+        if not weights.get(name) or name not in metrics or not baseline.get(name):
+            continue
+        value = weights[name] * metrics[name] / baseline[name]
+        total += value if higher else -value
+    return total
+
+
+def dominates(a, b):
+    better = False
+    for name, higher in objectives:
+        if name not in a or name not in b:
+            continue
+        x, y = (a[name], b[name]) if higher else (b[name], a[name])
+        if x < y:
+            return False
+        better = better or x > y
+    return better
+
+
+def pareto_front(entries):
+    return [e for e in entries if not any(dominates(o["metrics"], e["metrics"]) for o in entries if o is not e)]
+
+
+def seed_rungs(num_seeds, rungs):
+    # Seeds of every rung, doubling up to all of them at the last one
+    return [list(range(1, max(1, num_seeds >> (rungs - 1 - i)) + 1)) for i in range(rungs)]
+
+
+def tune_profile(runner, param_defines, scenarios, candidates, rungs, args, weights):
+    alive = candidates
+    entries = []
+    for i, seeds in enumerate(rungs):
+        runner.log("\nRung {}: {} candidates x {} scenarios x {} seeds".format(i + 1, len(alive), len(scenarios), len(seeds)))
+        # Runs of the previous rungs come from the cache
+        results = runner.sweep(scenarios, seeds, alive)
+        entries = []
+        for params in alive:
+            runs = [r for r in results if r["params"] == params]
+            if runs:
+                entries.append({"params": params, "runs": len(runs), "metrics": mean_metrics(runs)})
+        baseline = next((e["metrics"] for e in entries if not e["params"]), None)
+        if baseline is None:
+            raise RuntimeError("the defaults of params.h failed, see the runs in {}".format(runner.out_dir))
+        for e in entries:
+            e["score"] = score(e["metrics"], baseline, weights)
+        entries.sort(key=lambda e: -e["score"])
+        if i == len(rungs) - 1:
+            break
+
+        # The defaults always go on, as the reference of the score
+        kept = [e for e in entries if e["params"] and e["metrics"].get("pdr", 0) >= args.min_pdr]
+        kept = kept[:max(1, int(math.ceil(len(kept) / args.eta)))]
+        for e in entries:
+            if e not in kept and e["params"]:
+                runner.log("Stopped {}: score {:.3f}, pdr {:.2f}".format(
+                    param_defines(e["params"]), e["score"], e["metrics"].get("pdr", 0)))
+        alive = [{}] + [e["params"] for e in kept]
+    return entries
+
+
+def print_entries(title, entries, param_defines):
+    names = [name for name, _ in objectives]
+    header = ["score", "runs"] + names + ["params"]
+    rows = [["{:.3f}".format(e["score"]), str(e["runs"])] +
+            ["{:.2f}".format(e["metrics"][n]) if n in e["metrics"] else "-" for n in names] +
+            [param_defines(e["params"]) or "defaults"] for e in entries]
+    widths = [max(len(x) for x in col) for col in zip(header, *rows)]
+    print("\n----- {} -----\n".format(title))
+    for row in [header] + rows:
+        print("  ".join(x.ljust(w) for x, w in zip(row, widths)))
+
+
+def write_conf(path, profile, entry, scenarios):
+    with open(path, 'w') as f:
+        f.write("# Profile {} tuned on {}\n".format(profile, ", ".join(os.path.basename(s) for s in scenarios)))
+        f.write("# score {:.3f}, {}\n".format(entry["score"], ", ".join(
+            "{} {:.2f}".format(k, v) for k, v in sorted(entry["metrics"].items()))))
+        if not entry["params"]:
+            f.write("# the defaults of params.h are the best\n")
+        for name, value in sorted(entry["params"].items()):
+            f.write("{}={}\n".format(name, value))
+
+
+def parse_profiles(specs):
+    # name=scenario[@scale],...
+    profiles = {}
+    for spec in specs:
+        name, _, scenarios = spec.partition('=')
+        profiles[name.strip()] = []
+        for s in scenarios.split(','):
+            scenario, _, scale = s.strip().partition('@')
+            profiles[name.strip()].append((scenario, float(scale) if scale else 1.0))
+    return profiles
+
+
+def parse_weights(spec):
+    weights = {}
+    for w in spec.split(','):
+        name, _, value = w.partition('=')
+        weights[name.strip()] = float(value)
+    return weights
+
+
+def parse_args():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--profile', type=str, action='append', default=[],
+                        help="name=scenario[@scale],... profile to tune, sparse, dense and mobile by default")
+    parser.add_argument('-p', '--param', type=str, action='append', default=[],
+                        help="NAME=v1,v2,... values tried for a parameter, replacing the default search space")
+    parser.add_argument('-c', '--candidates', type=int, default=16,
+                        help="candidates sampled from the search space, the defaults included")
+    parser.add_argument('-n', '--num-seeds', type=int, default=4,
+                        help="seeds of the candidates that reach the last rung")
+    parser.add_argument('-r', '--rungs', type=int, default=3,
+                        help="rungs of successive halving, each one doubles the seeds")
+    parser.add_argument('--eta', type=float, default=2,
+                        help="fraction 1/eta of the candidates kept at every rung")
+    parser.add_argument('--min-pdr', type=float, default=90,
+                        help="candidates under this PDR (%%) are stopped at the first rung they reach")
+    parser.add_argument('-w', '--weights', type=str, default=default_weights,
+                        help="weights of the objective, relative to the defaults of params.h")
+    parser.add_argument('--search-seed', type=int, default=1,
+                        help="seed of the sampling of the candidates")
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count(),
+                        help="parallel builds and simulations")
+    parser.add_argument('--contiki', type=str, default=os.environ.get("CONTIKI", os.path.join(base_dir, "..", "..", "contiki")),
+                        help="Contiki tree with Cooja built, $CONTIKI or ../../contiki by default")
+    parser.add_argument('-o', '--out', type=str, default=os.path.join(base_dir, "experiments"),
+                        help="directory of the builds, runs and cache, shared with run-experiments.py")
+    parser.add_argument('--timeout', type=int, default=None,
+                        help="seconds after which a simulation is stopped")
+    parser.add_argument('--sinks', type=str, default=None,
+                        help="sinks passed to parse-stats.py")
+    return parser.parse_args()
+
+
+if __name__ == '__main__':
+
+    args = parse_args()
+    experiments = load_experiments()
+    profiles = parse_profiles(args.profile) if args.profile else default_profiles
+    for scenarios in profiles.values():
+        for scenario, _ in scenarios:
+            if not os.path.isfile(os.path.join(base_dir, scenario)):
+                print("The scenario {} is not a file of {}.".format(scenario, base_dir))
+                sys.exit(1)
+    weights = parse_weights(args.weights)
+
+    runner = experiments.Runner(args.contiki, args.out, args.jobs, args.timeout, args.sinks)
+    if not os.path.isfile(runner.cooja):
+        print("Cooja not found in {}, build it with ant jar in tools/cooja.".format(runner.cooja))
+        sys.exit(1)
+
+    space = default_space
+    if args.param:
+        space = [(name, [p[name] for p in experiments.parse_params([spec])])
+                 for spec in args.param for name in [spec.partition('=')[0].strip()]]
+    candidates = sample_candidates(space, args.candidates, random.Random(args.search_seed))
+    rungs = seed_rungs(args.num_seeds, args.rungs)
+    tuning_dir = os.path.join(runner.out_dir, "tuning")
+    os.makedirs(tuning_dir, exist_ok=True)
+    print("{} profiles x {} candidates, seeds per rung {}, {} jobs".format(
+        len(profiles), len(candidates), [len(s) for s in rungs], args.jobs))
+
+    best = {}
+    with open(os.path.join(tuning_dir, "results.csv"), 'w') as csv:
+        csv.write("\t".join(["profile", "pareto", "score", "runs"] + [n for n, _ in objectives] + ["params"]) + "\n")
+        for profile, specs in sorted(profiles.items()):
+            scenarios = [scaled_scenario(s, scale, tuning_dir) for s, scale in specs]
+            try:
+                entries = tune_profile(runner, experiments.param_defines, scenarios, candidates, rungs, args, weights)
+            except RuntimeError as e:
+                print(e)
+                sys.exit(1)
+            front = pareto_front(entries)
+            print_entries("Pareto front of {}".format(profile), front, experiments.param_defines)
+            for e in entries:
+                csv.write("\t".join([profile, "1" if e in front else "0", "{:.3f}".format(e["score"]), str(e["runs"])] +
+                                    [str(e["metrics"].get(n, "")) for n, _ in objectives] +
+                                    [experiments.param_defines(e["params"]) or "defaults"]) + "\n")
+            # The best by score is on the front by construction, unless all the weights are 0
+            best[profile] = entries[0]
+            write_conf(os.path.join(tuning_dir, "{}.conf".format(profile)), profile, entries[0], scenarios)
+
+    print("\n----- Recommended profiles -----\n")
+    for profile, e in sorted(best.items()):
+        print("{}: {} (score {:.3f}), saved in {}".format(profile, experiments.param_defines(e["params"]) or "defaults",
+                                                           e["score"], os.path.join(tuning_dir, profile + ".conf")))
+    print("\nResults of the last rung saved in {}".format(os.path.join(tuning_dir, "results.csv")))